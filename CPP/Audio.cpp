@@ -0,0 +1,220 @@
+// Audio.cpp
+
+#include <math.h>
+#include <string.h>
+#include <time.h>
+
+#include "Audio.h"
+
+const double AUDIO_LEVEL = 0.25*32767;	// square wave amplitude
+
+static void audio_sleep()
+{
+	timespec t = { 0, 1000000 };	// 1 ms
+	nanosleep(&t, NULL);
+}
+
+
+Audio::Audio(AudioSink* s)
+{
+	sink = s;
+	phase = 0;
+	step = 880.0/AUDIO_RATE;
+	tone_left = 0;
+	use_pattern = false;
+	memset(bits, 0, sizeof(bits));
+	bit_pos = 0;
+	bit_step = 4000.0/AUDIO_RATE;
+	running = true;
+	thread = std::thread(sink->realtime() ? &Audio::run_realtime : &Audio::run_frames, this);
+}
+
+Audio::~Audio()
+{
+	running = false;
+	thread.join();
+}
+
+// the audio thread keeps up unless it's stuck, so wait for room rather
+// than lose a tone or a frame
+void Audio::post(int type, unsigned value, int index)
+{
+	Event ev = { type, index, value };
+	while(!events.push(ev))
+		std::this_thread::yield();
+}
+
+void Audio::tone(int frames)	{ post(EV_TONE, frames); }
+void Audio::pitch(int hz)		{ post(EV_PITCH, hz); }
+
+void Audio::pattern(const unsigned char* b, int rate)
+{
+	for(int i=0; i<4; i++)
+		post(EV_PATTERN, b[i*4]<<24 | b[i*4+1]<<16 | b[i*4+2]<<8 | b[i*4+3], i);
+	post(EV_RATE, rate);
+}
+
+void Audio::frame()				{ post(EV_FRAME, 0); }
+
+void Audio::apply(const Event& ev)
+{
+	switch(ev.type) {
+		case EV_TONE:
+			if(tone_left==0) {
+				phase = 0;
+				bit_pos = 0;
+			}
+			tone_left = (long long)ev.value * AUDIO_FRAME;
+			break;
+		case EV_PITCH:
+			// pitch 0 is silence, keep the phase running anyway
+			step = ev.value>0 ? (double)(int)ev.value/AUDIO_RATE : 0;
+			use_pattern = false;
+			break;
+		case EV_PATTERN:
+			for(int i=0; i<4; i++)
+				bits[ev.index*4+i] = ev.value >> (24-i*8);
+			use_pattern = true;
+			break;
+		case EV_RATE:
+			// XO-CHIP: 4000*2^((rate-64)/48) bits a second
+			bit_step = 4000.0*pow(2.0, ((int)ev.value-64)/48.0)/AUDIO_RATE;
+			break;
+	}
+}
+
+// PolyBLEP: smooths the step at t=0 over one sample each side,
+// takes out most of the aliasing of a naive square wave
+static double blep(double t, double dt)
+{
+	if(t<dt) {
+		t /= dt;
+		return t+t - t*t - 1.0;
+	}
+	if(t>1.0-dt) {
+		t = (t-1.0)/dt;
+		return t*t + t+t + 1.0;
+	}
+	return 0.0;
+}
+
+void Audio::render(short* out, int n)
+{
+	int i = 0;
+	// the pattern is played as it is, 1 bits high, 0 bits low
+	for(; i<n && tone_left>0 && use_pattern; i++) {
+		int b = (int)bit_pos;
+		out[i] = (short)((bits[b>>3] >> (7-(b&7)) & 1) ? AUDIO_LEVEL : -AUDIO_LEVEL);
+
+		bit_pos += bit_step;
+		if(bit_pos>=128.0)
+			bit_pos -= 128.0;
+		tone_left--;
+	}
+	for(; i<n && tone_left>0 && step>0; i++) {
+		double v = phase<0.5 ? 1.0 : -1.0;
+		v += blep(phase, step);
+		v -= blep(fmod(phase+0.5, 1.0), step);
+		out[i] = (short)(v*AUDIO_LEVEL);
+
+		phase += step;
+		if(phase>=1.0)
+			phase -= 1.0;
+		tone_left--;
+	}
+	if(step<=0 && tone_left>0) {
+		// silent pitch, still counts down
+		long long quiet = tone_left < n-i ? tone_left : n-i;
+		tone_left -= quiet;
+	}
+	memset(out+i, 0, (n-i)*sizeof(short));
+}
+
+// sound card: a block whenever there's room, events take effect at the
+// next block, frames don't matter
+void Audio::run_realtime()
+{
+	short block[AUDIO_BLOCK];
+	while(running) {
+		if(!sink->ready()) {
+			audio_sleep();
+			continue;
+		}
+		Event ev;
+		while(events.pop(ev))
+			apply(ev);
+		render(block, AUDIO_BLOCK);
+		sink->write(block, AUDIO_BLOCK);
+	}
+}
+
+// file or nothing: one frame of samples per frame event, so the output
+// lines up with emulated time however fast the machine runs
+void Audio::run_frames()
+{
+	short block[AUDIO_FRAME];
+	while(true) {
+		Event ev;
+		if(!events.pop(ev)) {
+			if(!running)
+				break;
+			audio_sleep();
+			continue;
+		}
+		if(ev.type==EV_FRAME) {
+			render(block, AUDIO_FRAME);
+			sink->write(block, AUDIO_FRAME);
+		} else
+			apply(ev);
+	}
+}
+
+
+WavSink::WavSink(const char* filename)
+{
+	samples = 0;
+	file = fopen(filename, "wb");
+	if(file==NULL)
+		printf("Can't write %s\n", filename);
+	else
+		header();
+}
+
+WavSink::~WavSink()
+{
+	if(file==NULL)
+		return;
+	// sizes are known now
+	fseek(file, 0, SEEK_SET);
+	header();
+	fclose(file);
+}
+
+static void put16(FILE* f, int v)	{ fputc(v & 0xFF, f); fputc((v>>8) & 0xFF, f); }
+static void put32(FILE* f, int v)	{ put16(f, v & 0xFFFF); put16(f, (v>>16) & 0xFFFF); }
+
+void WavSink::header()
+{
+	int data = samples*sizeof(short);
+	fwrite("RIFF", 1, 4, file);
+	put32(file, 36 + data);
+	fwrite("WAVEfmt ", 1, 8, file);
+	put32(file, 16);				// fmt chunk size
+	put16(file, 1);					// PCM
+	put16(file, 1);					// mono
+	put32(file, AUDIO_RATE);
+	put32(file, AUDIO_RATE*sizeof(short));
+	put16(file, sizeof(short));		// block align
+	put16(file, 16);				// bits
+	fwrite("data", 1, 4, file);
+	put32(file, data);
+}
+
+void WavSink::write(const short* s, int n)
+{
+	if(file==NULL)
+		return;
+	for(int i=0; i<n; i++)
+		put16(file, s[i]);
+	samples += n;
+}
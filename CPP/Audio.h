@@ -0,0 +1,115 @@
+// Audio.h
+
+#ifndef AUDIO_H
+#define AUDIO_H
+
+#include <stdio.h>
+
+#include <atomic>
+#include <thread>
+
+#include "Ring.h"
+
+const int AUDIO_RATE	= 44100;
+const int AUDIO_BLOCK	= 256;				// samples per block for a realtime sink, ~6ms
+const int AUDIO_FRAME	= AUDIO_RATE/60;	// samples per 60Hz frame
+
+// Where the samples go, called on the audio thread only
+// a realtime sink (sound card) pulls blocks at its own pace, any other sink
+// gets exactly AUDIO_FRAME samples per emulated frame
+class AudioSink {
+public:
+	virtual ~AudioSink() {}
+	virtual bool realtime() { return false; }
+	virtual bool ready() { return true; }		// realtime: room for another block
+	virtual void write(const short* samples, int n) = 0;
+};
+
+// throws the samples away, counts them
+class NullSink : public AudioSink {
+public:
+	long long samples;
+
+	NullSink() : samples(0) {}
+	void write(const short* s, int n) { samples += n; }
+};
+
+// 16 bit mono WAV file
+class WavSink : public AudioSink {
+public:
+	WavSink(const char* filename);
+	~WavSink();
+
+	bool ok() const { return file!=NULL; }
+	void write(const short* s, int n);
+
+private:
+	FILE* file;
+	long long samples;
+
+	void header();
+};
+
+
+// Audio engine for one machine
+// The emulation thread only posts events into a lock-free ring, a thread of
+// its own turns them into a band-limited square wave for the sink, or
+// loops an XO-CHIP 128 bit pattern at its rate.
+// Beep length is counted in samples (ST frames * AUDIO_FRAME), not in ticks.
+//
+// usage:
+//	WavSink wav("out.wav");
+//	Audio audio(&wav);
+//	audio.pitch(chip.pitch); audio.tone(chip.ST);	// on SET_SV
+//	audio.pitch(chip.pitch);						// on SET_PV, a beep that's on follows
+//	audio.pattern(chip.pattern, chip.rate);			// XO-CHIP, instead of pitch
+//	audio.frame();									// every 60Hz frame
+class Audio {
+public:
+	Audio(AudioSink* sink);
+	~Audio();					// plays out what was posted (not realtime), stops the thread
+	Audio(const Audio&) = delete;
+	Audio& operator=(const Audio&) = delete;
+
+	// emulation thread
+	void tone(int frames);		// beep for frames/60 s from now, 0: off
+	void pitch(int hz);			// square wave
+	void pattern(const unsigned char* bits, int rate);	// 16 bytes, rate as Fx3A
+	void frame();				// a frame of emulated time has passed
+
+private:
+	enum AUDIO_EV {
+		EV_TONE,
+		EV_PITCH,
+		EV_PATTERN,				// 4 of them, index: which 4 bytes
+		EV_RATE,
+		EV_FRAME,
+	};
+	struct Event {
+		int type;
+		int index;
+		unsigned value;
+	};
+
+	AudioSink* sink;
+	Ring<Event, 1024> events;
+	std::atomic<bool> running;
+	std::thread thread;
+
+	// synth state, audio thread only
+	double phase;				// 0..1
+	double step;				// phase per sample
+	long long tone_left;		// samples of beep left
+	bool use_pattern;
+	unsigned char bits[16];
+	double bit_pos;				// 0..128
+	double bit_step;			// bits per sample
+
+	void post(int type, unsigned value, int index=0);
+	void apply(const Event& ev);
+	void render(short* out, int n);
+	void run_realtime();
+	void run_frames();
+};
+
+#endif
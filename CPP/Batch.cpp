@@ -0,0 +1,315 @@
+// Batch.cpp
+
+// Run many ROMs headless on all cores
+// one job per ROM x budget (x quirk combination), one Chip8 per job
+// prints one line per job: final screen hash, exit code, instruction count, wall time
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "Chip8.h"
+#include "Jit.h"
+#include "Pool.h"
+
+struct Job {
+	std::string rom;
+	long long budget;
+	int quirks;				// QUIRK_* mask or QUIRKS_AUTO
+
+	// results
+	bool loaded;
+	bool resumed;			// started from a checkpoint
+	bool halted;			// program stopped itself (STOP, error) before budget
+	int exit_code;
+	int quirks_used;		// what the machine ran with
+	word pc;
+	long long instr;
+	long long frames;
+	double ms;
+	unsigned long long hash;
+};
+
+std::vector<std::string> roms;
+std::vector<long long> budgets;
+int instr_per_frame = 16;
+int threads = 0;
+bool all_quirks = false;
+bool use_jit = false;
+unsigned int seed = 1;				// same RAND for every job and every run
+const char* checkpoint_dir = NULL;
+long long checkpoint_frames = 3600;	// one emulated minute
+
+
+double elapsed(timespec* t0, timespec* t1)
+{
+	return (t1->tv_sec - t0->tv_sec) + (t1->tv_nsec - t0->tv_nsec)/1e9;
+}
+
+// FNV-1a, 64 bit, over the pixels (1 byte per pixel)
+// plane 0 alone hashes as SCREEN_PIXEL, so one plane screens keep their hash
+unsigned long long hash_screen(const Screen& scr)
+{
+	static const unsigned char value[4] = { 0, SCREEN_PIXEL, 0x55, 0xAA };
+	unsigned long long h = 0xcbf29ce484222325ULL;
+	for(int y=0; y<scr.height; y++)
+		for(int x=0; x<scr.width; x++) {
+			h ^= value[scr.color(x, y)];
+			h *= 0x100000001b3ULL;
+		}
+	return h;
+}
+
+// checkpoint file of a job: instructions:64 frames:64, then the save state
+std::string checkpoint_file(Job* job)
+{
+	std::string name = job->rom;
+	std::replace(name.begin(), name.end(), '/', '_');
+	char tail[64];
+	snprintf(tail, sizeof(tail), ".%d.%lld.c8s", job->quirks, job->budget);
+	return std::string(checkpoint_dir) + "/" + name + tail;
+}
+
+void checkpoint_save(Job* job, Chip8& chip, std::vector<byte>& data)
+{
+	chip.save_state(data);
+	std::string file = checkpoint_file(job);
+	std::string tmp = file + ".tmp";
+
+	FILE* f = fopen(tmp.c_str(), "wb");
+	if(f==NULL)
+		return;
+	bool ok = fwrite(&job->instr, 8, 1, f)==1 && fwrite(&job->frames, 8, 1, f)==1
+			&& fwrite(data.data(), 1, data.size(), f)==data.size();
+	ok = fclose(f)==0 && ok;
+	// rename, so a kill half way through a write leaves the last good one
+	if(ok)
+		rename(tmp.c_str(), file.c_str());
+}
+
+bool checkpoint_load(Job* job, Chip8& chip)
+{
+	FILE* f = fopen(checkpoint_file(job).c_str(), "rb");
+	if(f==NULL)
+		return false;
+	std::vector<byte> data;
+	byte buf[4096];
+	int n;
+	while((n = fread(buf, 1, sizeof(buf), f))>0)
+		data.insert(data.end(), buf, buf+n);
+	fclose(f);
+
+	if(data.size()<16 || !chip.load_state(data.data()+16, data.size()-16))
+		return false;
+	memcpy(&job->instr, data.data(), 8);
+	memcpy(&job->frames, data.data()+8, 8);
+	return true;
+}
+
+void run_job(Job* job)
+{
+	timespec t0, t1;
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+
+	Chip8 chip;
+	chip.set_quirks(job->quirks);
+
+	Jit* jit = NULL;
+	if(use_jit)
+		jit = new Jit(&chip);
+
+	job->halted = false;
+	job->instr = 0;
+	job->frames = 0;
+	job->resumed = checkpoint_dir!=NULL && checkpoint_load(job, chip);
+	if(!job->resumed) {
+		job->loaded = chip.load_file(job->rom.c_str());
+		chip.seed(seed);
+	} else
+		job->loaded = true;
+
+	std::vector<byte> state;
+	if(job->loaded) {
+		// same clocking as Program -H: timers tick every instr_per_frame
+		while(job->instr < job->budget) {
+			long long n = std::min((long long)instr_per_frame, job->budget - job->instr);
+			job->instr += chip.run(n);
+			if(chip.halted) {
+				job->halted = true;
+				break;
+			}
+			chip.timers_tick();
+			job->frames++;
+			if(checkpoint_dir!=NULL && job->frames%checkpoint_frames==0)
+				checkpoint_save(job, chip, state);
+		}
+		if(checkpoint_dir!=NULL)
+			remove(checkpoint_file(job).c_str());
+	}
+	job->exit_code = chip.exit_code;
+	job->quirks_used = chip.quirks;
+	job->pc = chip.PC;
+	job->hash = hash_screen(chip.framebuffer());
+	delete jit;
+
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	job->ms = elapsed(&t0, &t1)*1000.0;
+}
+
+// all regular files in a directory, sorted
+void add_dir(const char* path)
+{
+	DIR* dir = opendir(path);
+	if(dir==NULL)
+		return;
+
+	std::vector<std::string> files;
+	while(dirent* ent = readdir(dir)) {
+		std::string file = std::string(path) + "/" + ent->d_name;
+		struct stat st;
+		if(stat(file.c_str(), &st)==0 && S_ISREG(st.st_mode))
+			files.push_back(file);
+	}
+	closedir(dir);
+
+	std::sort(files.begin(), files.end());
+	roms.insert(roms.end(), files.begin(), files.end());
+}
+
+void add_budgets(const char* list)
+{
+	const char* p = list;
+	while(*p) {
+		long long n = atoll(p);
+		if(n>0)
+			budgets.push_back(n);
+		p = strchr(p, ',');
+		if(p==NULL)
+			break;
+		p++;
+	}
+}
+
+void usage(const char* name)
+{
+	printf("usage: %s [-n budget[,budget..]] [-i instr/frame] [-j threads] [-Q] [-J] [-s seed] [-c dir] [-C frames] rom|dir ...\n", name);
+	printf("\t-n\tinstruction budgets, one job per budget (default 1000000)\n");
+	printf("\t-i\tinstructions per frame (default %d)\n", instr_per_frame);
+	printf("\t-j\tworker threads (default one per core)\n");
+	printf("\t-Q\trun every quirk profile (vip chip48 schip xochip default), not just the one picked from the ROM\n");
+	printf("\t-J\tcompile to native code (x86-64)\n");
+	printf("\t-s\tRAND seed (default %u)\n", seed);
+	printf("\t-c\tcheckpoint jobs to dir, and resume from there if a checkpoint is left\n");
+	printf("\t-C\tframes between checkpoints (default %lld)\n", checkpoint_frames);
+}
+
+void cli_arguments(int argc, char** argv)
+{
+	for(int i=1; i<argc; i++) {
+		char* arg = argv[i];
+		bool has_val = i+1<argc;
+
+		if(strcmp(arg, "-Q")==0)
+			all_quirks = true;
+		else if(strcmp(arg, "-J")==0)
+			use_jit = true;
+		else if(strcmp(arg, "-n")==0 && has_val)
+			add_budgets(argv[++i]);
+		else if(strcmp(arg, "-i")==0 && has_val)
+			instr_per_frame = atoi(argv[++i]);
+		else if(strcmp(arg, "-s")==0 && has_val)
+			seed = strtoul(argv[++i], NULL, 0);
+		else if(strcmp(arg, "-c")==0 && has_val)
+			checkpoint_dir = argv[++i];
+		else if(strcmp(arg, "-C")==0 && has_val)
+			checkpoint_frames = atoll(argv[++i]);
+		else if(strcmp(arg, "-j")==0 && has_val)
+			threads = atoi(argv[++i]);
+		else if(arg[0]=='-') {
+			usage(argv[0]);
+			exit(1);
+		} else {
+			struct stat st;
+			if(stat(arg, &st)==0 && S_ISDIR(st.st_mode))
+				add_dir(arg);
+			else
+				roms.push_back(arg);
+		}
+	}
+	if(instr_per_frame<1)
+		instr_per_frame = 1;
+	if(checkpoint_frames<1)
+		checkpoint_frames = 1;
+	if(budgets.empty())
+		budgets.push_back(1000000);
+}
+
+int main(int argc, char** argv)
+{
+	cli_arguments(argc, argv);
+	if(roms.empty()) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	// the profile picked from the ROM, or every named one
+	std::vector<int> quirks;
+	if(all_quirks)
+		for(const QuirkProfile* p=quirk_profiles; p->name!=NULL; p++)
+			quirks.push_back(p->quirks);
+	else
+		quirks.push_back(QUIRKS_AUTO);
+
+	std::vector<Job> jobs;
+	for(std::string& rom : roms)
+		for(long long budget : budgets)
+			for(int q : quirks) {
+				Job job;
+				job.rom = rom;
+				job.budget = budget;
+				job.quirks = q;
+				jobs.push_back(job);
+			}
+
+	timespec t0, t1;
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+
+	Pool pool(threads);
+	for(Job& job : jobs) {
+		Job* p = &job;
+		pool.add([p]() { run_job(p); });
+	}
+	pool.run();
+
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+
+	int failed = 0;
+	int resumed = 0;
+	long long total = 0;
+	printf("rom\tquirks\tbudget\tstop\texit\tpc\tinstructions\tframes\tms\thash\n");
+	for(Job& job : jobs) {
+		const char* stop = !job.loaded ? "noload" : (job.halted ? "halt" : "budget");
+		if(!job.loaded)
+			failed++;
+		if(job.resumed)
+			resumed++;
+		total += job.instr;
+		const char* name = quirks_name(job.quirks_used);
+		printf("%s\t%s\t%lld\t%s\t%d\t%04X\t%lld\t%lld\t%.3f\t%016llx\n",
+				job.rom.c_str(), name!=NULL ? name : "-",
+				job.budget, stop, job.exit_code, job.pc, job.instr, job.frames, job.ms, job.hash);
+	}
+
+	double sec = elapsed(&t0, &t1);
+	fprintf(stderr, "BATCH: jobs=%d failed=%d resumed=%d threads=%d instructions=%lld time=%.3fs IPS=%.0f\n",
+			(int)jobs.size(), failed, resumed, pool.size(), total, sec, sec>0 ? total/sec : 0.0);
+
+	return failed>0 ? 1 : 0;
+}
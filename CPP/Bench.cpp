@@ -0,0 +1,359 @@
+// Bench.cpp
+
+// Emulator speed, as JSON on stdout
+// micro: one small program per opcode (group), mostly that opcode repeated,
+//        run with the interpreter and the JIT
+// rom:   whole ROMs, clocked like Batch (timers every instr_per_frame)
+// compare two runs to catch a slowdown: every entry has a name and an ips
+// -c n: no timing, runs every micro and ROM n instructions with the
+//        interpreter and with the JIT and compares the save states
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "Chip8.h"
+#include "Jit.h"
+#include "Trace.h"
+
+double min_time = 0.1;			// -t: seconds per measurement
+int reps = 3;					// -r: measurements per entry, the best counts
+int instr_per_frame = 16;
+long long check_instr = 0;		// -c: check the JIT against the interpreter instead
+std::vector<std::string> roms;
+
+
+double now()
+{
+	timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec/1e9;
+}
+
+// a program: setup, then a body repeated to fill the loop, then JMP to the body
+// {a} in the body is replaced by the address of that copy, for jumps and calls
+struct Micro {
+	const char* name;
+	const char* group;			// OP_GRP, OP_ALU or OP_SPEC name in Chip8.cpp
+	std::vector<word> setup;
+	std::vector<word> body;
+	int addr_arg;				// body word whose low 12 bits get the next copy's address, -1: none
+	bool sub;					// put a RET at the end, the body CALLs it
+};
+
+const int BODY_COPIES = 64;
+const word DATA = 0xE00;		// scratch memory for STO/BCD, above the program
+
+std::vector<byte> build(const Micro& m, word& sub_addr)
+{
+	std::vector<word> prog = m.setup;
+	word loop = PROG_START + prog.size()*2;
+	int body_words = m.body.size();
+	sub_addr = loop + (BODY_COPIES*body_words + 1)*2;
+
+	for(int c=0; c<BODY_COPIES; c++)
+		for(int i=0; i<body_words; i++) {
+			word op = m.body[i];
+			if(i==m.addr_arg) {
+				word next = loop + ((c+1)*body_words)*2;	// the instruction after this copy
+				op = (op & 0xF000) | (m.sub ? sub_addr : next);
+			}
+			prog.push_back(op);
+		}
+	prog.push_back(0x1000 | loop);
+	if(m.sub)
+		prog.push_back(0x00EE);
+
+	std::vector<byte> bytes;
+	for(word w : prog) {
+		bytes.push_back(w>>8);
+		bytes.push_back(w & 0xFF);
+	}
+	return bytes;
+}
+
+std::vector<Micro> micros()
+{
+	std::vector<Micro> v;
+	// V0=0 V1=1 V2=2, IX=DATA, unless a benchmark says otherwise
+	std::vector<word> regs = { 0x6000, 0x6101, 0x6202, 0xA000|DATA };
+	std::vector<word> font = { 0x6005, 0x6103, 0x6200, 0xF229 };	// IX = digit 0
+	std::vector<word> planes = { 0x6005, 0x6103, 0x6200, 0xF229, 0xF301 };	// XO-CHIP, both planes
+
+	v.push_back({ "00E0 CLS",			"SYS_OP",	regs, { 0x00E0 }, -1, false });
+	v.push_back({ "1nnn JMP",			"JMP_N",	regs, { 0x1000 }, 0, false });
+	v.push_back({ "2nnn CALL+RET",		"CALL_N",	regs, { 0x2000 }, 0, true });
+	v.push_back({ "3xnn SKEQ",			"SKEQ_VN",	regs, { 0x3001 }, -1, false });
+	v.push_back({ "4xnn SKNE",			"SKNE_VN",	regs, { 0x4000 }, -1, false });
+	v.push_back({ "5xy0 SKEQ",			"SKEQ_VV",	regs, { 0x5010 }, -1, false });
+	v.push_back({ "5xy2 STO V0-VF",		"STO_VV",	regs, { 0x50F2 }, -1, false });
+	v.push_back({ "5xy3 RCL V0-VF",		"RCL_VV",	regs, { 0x50F3 }, -1, false });
+	v.push_back({ "6xnn SET",			"SET_VN",	regs, { 0x6342 }, -1, false });
+	v.push_back({ "7xnn ADD",			"ADD_VN",	regs, { 0x7301 }, -1, false });
+	v.push_back({ "8xy0 CP",			"CP",		regs, { 0x8310 }, -1, false });
+	v.push_back({ "8xy1 OR",			"OR",		regs, { 0x8311 }, -1, false });
+	v.push_back({ "8xy2 AND",			"AND",		regs, { 0x8312 }, -1, false });
+	v.push_back({ "8xy3 XOR",			"XOR",		regs, { 0x8313 }, -1, false });
+	v.push_back({ "8xy4 ADD",			"ADD",		regs, { 0x8314 }, -1, false });
+	v.push_back({ "8xy5 SUB",			"SUB",		regs, { 0x8315 }, -1, false });
+	v.push_back({ "8xy6 SHR",			"SHR",		regs, { 0x8316 }, -1, false });
+	v.push_back({ "8xy7 RSUB",			"RSUB",		regs, { 0x8317 }, -1, false });
+	v.push_back({ "8xyE SHL",			"SHL",		regs, { 0x831E }, -1, false });
+	v.push_back({ "9xy0 SKNE",			"SKNE_VV",	regs, { 0x9000 }, -1, false });
+	v.push_back({ "Annn SET IX",		"SET_IN",	regs, { 0xA000|DATA }, -1, false });
+	v.push_back({ "Bnnn JMP V0",		"JMP_V0N",	regs, { 0xB000 }, 0, false });
+	v.push_back({ "Cxnn RAND",			"RND_VN",	regs, { 0xC3FF }, -1, false });
+	v.push_back({ "Dxy1 DRAW",			"DRAW_VVN",	font, { 0xD011 }, -1, false });
+	v.push_back({ "Dxy5 DRAW",			"DRAW_VVN",	font, { 0xD015 }, -1, false });
+	v.push_back({ "Dxy8 DRAW",			"DRAW_VVN",	font, { 0xD018 }, -1, false });
+	v.push_back({ "DxyF DRAW",			"DRAW_VVN",	font, { 0xD01F }, -1, false });
+	v.push_back({ "Dxy0 DRAW 16",		"DRAW_VVN",	font, { 0xD010 }, -1, false });
+	v.push_back({ "Dxy8 DRAW 2 planes",	"DRAW_VVN",	planes, { 0xD018 }, -1, false });
+	v.push_back({ "Ex9E SKP",			"KEY_OP",	regs, { 0xE09E }, -1, false });
+	v.push_back({ "ExA1 SKNP+skipped",	"KEY_OP",	regs, { 0xE0A1, 0x6342 }, -1, false });	// no key: always skips
+	v.push_back({ "Fx07 GET TIMER",		"GET_VT",	regs, { 0xF307 }, -1, false });
+	v.push_back({ "Fx15 SET TIMER",		"SET_TV",	regs, { 0xF015 }, -1, false });
+	v.push_back({ "Fx17 SET PITCH",		"SET_PV",	regs, { 0xF117 }, -1, false });
+	v.push_back({ "Fx18 SET SOUND",		"SET_SV",	regs, { 0xF018 }, -1, false });
+	v.push_back({ "Fx1E ADD IX",		"ADD_IV",	regs, { 0xF01E }, -1, false });
+	v.push_back({ "Fx29 FONT",			"GET_IF",	regs, { 0xF229 }, -1, false });
+	v.push_back({ "Fx33 BCD",			"BCD_IV",	regs, { 0xF233 }, -1, false });
+	v.push_back({ "Fx55 STO V0-VF",		"STO_IV",	regs, { 0xFF55 }, -1, false });
+	v.push_back({ "Fx65 RCL V0-VF",		"RCL_IV",	regs, { 0xFF65 }, -1, false });
+	return v;
+}
+
+// run n instructions at a time until min_time, best of reps, in IPS
+double measure(Chip8& chip, long long n, long long& instr)
+{
+	double best = 0;
+	for(int r=0; r<reps; r++) {
+		long long cnt = 0;
+		double t0 = now(), t1;
+		do {
+			cnt += chip.run(n);
+			if(chip.halted) {
+				printf("bench program stopped at PC=%04X\n", chip.PC);
+				exit(1);
+			}
+			t1 = now();
+		} while(t1-t0<min_time);
+		instr += cnt;
+		best = std::max(best, cnt/(t1-t0));
+	}
+	return best;
+}
+
+void print_entry(bool& first, const char* kind, const std::string& name, const char* group,
+		const char* mode, long long instr, double ips)
+{
+	printf("%s\n\t\t{\"kind\": \"%s\", \"name\": \"%s\", ", first ? "" : ",", kind, name.c_str());
+	if(group!=NULL)
+		printf("\"group\": \"%s\", ", group);
+	printf("\"mode\": \"%s\", \"instructions\": %lld, \"ips\": %.0f, \"ns_per_instr\": %.3f}",
+			mode, instr, ips, ips>0 ? 1e9/ips : 0.0);
+	fflush(stdout);
+	first = false;
+}
+
+void run_micros(bool& first)
+{
+	for(const Micro& m : micros()) {
+		word sub;
+		std::vector<byte> prog = build(m, sub);
+		for(int jit=0; jit<2; jit++) {
+			Chip8 chip;
+			chip.seed(1);
+			chip.load(prog.data(), prog.size());
+			Jit* j = jit ? new Jit(&chip) : NULL;
+			long long instr = 0;
+			double ips = measure(chip, 100000, instr);
+			delete j;
+			print_entry(first, "micro", m.name, m.group, jit ? "jit" : "interp", instr, ips);
+		}
+	}
+}
+
+// like a Batch job: a frame of instructions, then the timers
+void run_roms(bool& first)
+{
+	for(const std::string& rom : roms)
+		for(int jit=0; jit<2; jit++) {
+			Chip8 chip;
+			chip.seed(1);
+			if(!chip.load_file(rom.c_str()))
+				continue;
+			Jit* j = jit ? new Jit(&chip) : NULL;
+
+			double best = 0;
+			long long instr = 0;
+			bool halted = false;
+			for(int r=0; r<reps && !halted; r++) {
+				long long cnt = 0;
+				double t0 = now(), t1;
+				do {
+					for(int f=0; f<1000; f++) {
+						cnt += chip.run(instr_per_frame);
+						if(chip.halted) {
+							halted = true;
+							break;
+						}
+						chip.timers_tick();
+					}
+					t1 = now();
+				} while(t1-t0<min_time && !halted);
+				instr += cnt;
+				best = std::max(best, cnt/(t1-t0));
+			}
+			delete j;
+			print_entry(first, "rom", rom, NULL, jit ? "jit" : "interp", instr, best);
+		}
+}
+
+// n instructions, a frame at a time with the timers for ROMs, then the state
+long long run_state(Chip8& chip, bool jit, long long n, bool frames, std::vector<byte>& state)
+{
+	Jit* j = jit ? new Jit(&chip) : NULL;
+	long long done = 0;
+	while(done<n) {
+		long long step = frames ? std::min((long long)instr_per_frame, n-done) : n-done;
+		done += chip.run(step);
+		if(chip.halted)
+			break;
+		if(frames)
+			chip.timers_tick();
+	}
+	delete j;
+	chip.save_state(state);
+	return done;
+}
+
+// both ways from the same start, returns false when they differ
+bool check(bool& first, const char* kind, const std::string& name, const std::vector<byte>& prog, bool frames)
+{
+	std::vector<byte> state[2];
+	long long done[2];
+	for(int jit=0; jit<2; jit++) {
+		Chip8 chip;
+		chip.seed(1);
+		chip.load(prog.data(), prog.size());
+		done[jit] = run_state(chip, jit, check_instr, frames, state[jit]);
+	}
+
+	size_t diff = 0;
+	while(diff<state[0].size() && diff<state[1].size() && state[0][diff]==state[1][diff])
+		diff++;
+	bool same = done[0]==done[1] && state[0]==state[1];
+
+	printf("%s\n\t\t{\"kind\": \"%s\", \"name\": \"%s\", \"mode\": \"check\", \"instructions\": %lld, \"same\": %s",
+			first ? "" : ",", kind, name.c_str(), done[0], same ? "true" : "false");
+	if(!same)
+		printf(", \"jit_instructions\": %lld, \"state_byte\": %zu", done[1], diff);
+	printf("}");
+	fflush(stdout);
+	first = false;
+	return same;
+}
+
+int run_checks(bool& first)
+{
+	int failed = 0;
+	for(const Micro& m : micros()) {
+		word sub;
+		if(!check(first, "micro", m.name, build(m, sub), false))
+			failed++;
+	}
+	for(const std::string& rom : roms) {
+		FILE* file = fopen(rom.c_str(), "rb");
+		if(file==NULL)
+			continue;
+		std::vector<byte> prog(PROG_MAX_SIZE+1);
+		prog.resize(fread(prog.data(), 1, prog.size(), file));
+		fclose(file);
+		if(prog.size()>(size_t)PROG_MAX_SIZE)
+			continue;
+		if(!check(first, "rom", rom, prog, true))
+			failed++;
+	}
+	return failed;
+}
+
+void add_dir(const char* path)
+{
+	DIR* dir = opendir(path);
+	if(dir==NULL)
+		return;
+	std::vector<std::string> files;
+	while(dirent* ent = readdir(dir)) {
+		std::string file = std::string(path) + "/" + ent->d_name;
+		struct stat st;
+		if(stat(file.c_str(), &st)==0 && S_ISREG(st.st_mode))
+			files.push_back(file);
+	}
+	closedir(dir);
+	std::sort(files.begin(), files.end());
+	roms.insert(roms.end(), files.begin(), files.end());
+}
+
+void usage(const char* name)
+{
+	printf("usage: %s [-t seconds] [-r reps] [-i instr/frame] [-c instr] [rom|dir ...]\n", name);
+	printf("\t-t\tminimum time per measurement (default %.2f)\n", min_time);
+	printf("\t-r\tmeasurements per entry, best one is reported (default %d)\n", reps);
+	printf("\t-i\tinstructions per frame for ROMs (default %d)\n", instr_per_frame);
+	printf("\t-c\tno timing, run everything instr instructions with and without the JIT\n");
+	printf("\t\tand compare the save states, exit code 1 when any differ\n");
+	printf("\tROMs default to roms/\n");
+}
+
+int main(int argc, char** argv)
+{
+	for(int i=1; i<argc; i++) {
+		char* arg = argv[i];
+		bool has_val = i+1<argc;
+		if(strcmp(arg, "-t")==0 && has_val)
+			min_time = atof(argv[++i]);
+		else if(strcmp(arg, "-r")==0 && has_val)
+			reps = atoi(argv[++i]);
+		else if(strcmp(arg, "-i")==0 && has_val)
+			instr_per_frame = atoi(argv[++i]);
+		else if(strcmp(arg, "-c")==0 && has_val)
+			check_instr = atoll(argv[++i]);
+		else if(arg[0]=='-') {
+			usage(argv[0]);
+			return 1;
+		} else {
+			struct stat st;
+			if(stat(arg, &st)==0 && S_ISDIR(st.st_mode))
+				add_dir(arg);
+			else
+				roms.push_back(arg);
+		}
+	}
+	if(reps<1)
+		reps = 1;
+	if(instr_per_frame<1)
+		instr_per_frame = 1;
+	if(roms.empty())
+		add_dir("roms");
+
+	printf("{\n\t\"format\": 1,\n\t\"trace_level\": %d,\n\t\"min_time\": %.3f,\n\t\"reps\": %d,\n\t\"results\": [",
+			TRACE_LEVEL, min_time, reps);
+	bool first = true;
+	int failed = 0;
+	if(check_instr>0)
+		failed = run_checks(first);
+	else {
+		run_micros(first);
+		run_roms(first);
+	}
+	printf("\n\t]\n}\n");
+	return failed>0 ? 1 : 0;
+}
@@ -0,0 +1,167 @@
+// Cfg.cpp
+
+// load time control flow walk, see Cfg.h
+
+#include "Cfg.h"
+
+// what an instruction does to the flow, by opcode
+enum FLOW {
+	FLOW_NEXT,			// on to the next instruction
+	FLOW_SKIP,			// next or the one after (3xnn 4xnn 5xyn 9xyn Ex9E ExA1)
+	FLOW_JUMP,			// 1nnn
+	FLOW_CALL,			// 2nnn, returns to the next one
+	FLOW_TABLE,			// Bnnn, somewhere from nnn on
+	FLOW_END			// RET, RST, STOP, 0nnn, undefined E ops
+};
+
+static FLOW flow(unsigned short op)
+{
+	switch(op>>12) {
+		case 0x0:
+			if(op==0x00EE || op==0x00FD || (op & 0x0F00)!=0)
+				return FLOW_END;
+			return FLOW_NEXT;
+		case 0x1:	return FLOW_JUMP;
+		case 0x2:	return FLOW_CALL;
+		case 0x5:	return ((op & 0xF)==0x2 || (op & 0xF)==0x3) ? FLOW_NEXT : FLOW_SKIP;	// XO STO/RCL range
+		case 0x3:
+		case 0x4:
+		case 0x9:	return FLOW_SKIP;
+		case 0xB:	return FLOW_TABLE;
+		case 0xE:	return ((op & 0xFF)==0x9E || (op & 0xFF)==0xA1) ? FLOW_SKIP : FLOW_END;
+		case 0xF:	return (op & 0xFF)==0x00 ? FLOW_END : FLOW_NEXT;
+	}
+	return FLOW_NEXT;
+}
+
+Cfg::Cfg()
+{
+	prog_start = 0;
+	prog_end = 0;
+	xo = false;
+}
+
+void Cfg::clear()
+{
+	flags.assign(flags.size(), 0);
+	blocks.clear();
+	prog_start = 0;
+	prog_end = 0;
+}
+
+void Cfg::analyze(const unsigned char* mem, int limit, int start, int size, bool xo)
+{
+	this->xo = xo;
+	flags.assign(limit, 0);
+	blocks.clear();
+	prog_start = start;
+	prog_end = start+size < limit ? start+size : limit;
+	if(size<2)
+		return;
+
+	std::vector<int> work;
+	work.push_back(start);
+	flags[start] |= LEADER;
+
+	while(!work.empty()) {
+		int addr = work.back();
+		work.pop_back();
+
+		// straight on until the flow leaves or runs into code already seen
+		while(in_prog(addr) && !(flags[addr] & CODE)) {
+			flags[addr] |= CODE;
+			flags[addr+1] |= OPERAND;
+			unsigned short op = mem[addr]<<8 | mem[addr+1];
+			int nnn = op & 0xFFF;
+
+			if(length(mem, addr)==4) {
+				if(!in_prog(addr, 4))
+					break;
+				int nnnn = mem[addr+2]<<8 | mem[addr+3];
+				flags[addr+2] |= OPERAND;
+				flags[addr+3] |= OPERAND;
+				if(nnnn<limit)
+					flags[nnnn] |= DATA;
+				addr += 4;
+				continue;
+			}
+
+			if((op>>12)==0xA && nnn<limit)
+				flags[nnn] |= DATA;
+
+			FLOW f = flow(op);
+			if(f==FLOW_NEXT) {
+				addr += 2;
+				continue;
+			}
+			if((f==FLOW_JUMP || f==FLOW_CALL) && nnn<limit) {
+				flags[nnn] |= LEADER | (f==FLOW_JUMP ? JUMP : CALL);
+				work.push_back(nnn);
+			}
+			if(f==FLOW_TABLE) {
+				// usually a row of JMPs, each one is a way in
+				if(nnn<limit)
+					flags[nnn] |= TABLE;
+				for(int a=nnn; in_prog(a) && (mem[a]>>4)==0x1 && a<nnn+256*2; a+=2) {
+					flags[a] |= LEADER;
+					work.push_back(a);
+				}
+			}
+			if(f==FLOW_SKIP) {
+				// a skip goes over all of F000 nnnn
+				int over = addr+2 + (in_prog(addr+2) ? length(mem, addr+2) : 2);
+				if(over<limit)
+					flags[over] |= LEADER;
+				work.push_back(over);
+			}
+			if(f==FLOW_SKIP || f==FLOW_CALL) {
+				flags[addr+2] |= LEADER;
+				addr += 2;
+				continue;
+			}
+			break;
+		}
+	}
+	build_blocks(mem);
+}
+
+// cut the code at leaders and after every instruction that changes the flow
+void Cfg::build_blocks(const unsigned char* mem)
+{
+	Block b = { 0, 0 };
+	bool open = false;
+	for(int addr=prog_start; addr<prog_end; addr++) {
+		if(!(flags[addr] & CODE)) {
+			if(open && !(flags[addr] & OPERAND)) {
+				blocks.push_back(b);
+				open = false;
+			}
+			continue;
+		}
+		if(open && (flags[addr] & LEADER)) {
+			blocks.push_back(b);
+			open = false;
+		}
+		if(!open) {
+			b.start = addr;
+			open = true;
+		}
+		int len = length(mem, addr);
+		b.end = addr+len;
+		if(len==2 && flow(mem[addr]<<8 | mem[addr+1])!=FLOW_NEXT) {
+			blocks.push_back(b);
+			open = false;
+		}
+	}
+	if(open)
+		blocks.push_back(b);
+}
+
+int Cfg::code_bytes() const
+{
+	int n = 0;
+	for(int addr=prog_start; addr<prog_end; addr++)
+		if(flags[addr] & (CODE|OPERAND))
+			n++;
+	return n;
+}
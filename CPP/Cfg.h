@@ -0,0 +1,72 @@
+// Cfg.h
+
+#ifndef CFG_H
+#define CFG_H
+
+#include <vector>
+
+// Static control flow of a loaded program
+//
+// analyze() walks the code reachable from the start address, following
+// jumps, calls, both ways of every skip, and the JMP tables after Bnnn, and
+// flags every address it sees. Bytes the walk never reaches are data.
+// Lookups are one array index, used by the trace ("@" on labels), the
+// disassembler and anything that wants basic blocks.
+//
+// The walk sees the program as loaded, code written at run time (STO/BCD)
+// and Bnnn targets that aren't in a JMP table are not in it.
+//
+// With xo, F000 nnnn is one 4 byte instruction (XO-CHIP long IX), the
+// second word is OPERAND and nnnn a DATA label.
+
+class Cfg {
+public:
+	enum {
+		CODE	= 0x01,		// an instruction starts here
+		OPERAND	= 0x02,		// any byte of an instruction after the first
+		LEADER	= 0x04,		// a basic block starts here
+		JUMP	= 0x08,		// 1nnn target
+		CALL	= 0x10,		// 2nnn target
+		TABLE	= 0x20,		// Bnnn base
+		DATA	= 0x40,		// Annn target
+		LABEL	= JUMP | CALL | TABLE | DATA
+	};
+
+	// [start, end) of straight line code, the last instruction ends it
+	// (jump, skip, RET, stop) or falls into the next block
+	struct Block {
+		int start;
+		int end;				// can be 0x10000
+	};
+
+	std::vector<Block> blocks;		// in address order
+
+	Cfg();
+
+	// the program is mem[start, start+size), flags are kept for [0, limit)
+	void analyze(const unsigned char* mem, int limit, int start, int size, bool xo=false);
+	void clear();
+
+	unsigned char at(int addr) const { return addr>=0 && addr<(int)flags.size() ? flags[addr] : 0; }
+	bool is_code(int addr) const	{ return (at(addr) & CODE)!=0; }
+	bool is_label(int addr) const	{ return (at(addr) & LABEL)!=0; }
+	bool is_data(int addr) const	{ return addr>=prog_start && addr<prog_end && (at(addr) & (CODE|OPERAND))==0; }
+
+	int code_bytes() const;
+
+	// bytes in the instruction at addr, 4 for F000 nnnn with xo
+	int length(const unsigned char* mem, int addr) const {
+		return xo && mem[addr]==0xF0 && mem[addr+1]==0x00 ? 4 : 2;
+	}
+
+private:
+	std::vector<unsigned char> flags;	// per memory address
+	int prog_start;
+	int prog_end;
+	bool xo;
+
+	bool in_prog(int addr, int len=2) const { return addr>=prog_start && addr+len-1<prog_end; }
+	void build_blocks(const unsigned char* mem);
+};
+
+#endif
@@ -7,10 +7,16 @@
 // use stdio for console log and debug interactive interface
 // wish I could uses iostream but it's not installed!?
 #include <stdio.h>      /* printf, scanf, puts, NULL */
-#include <stdlib.h>     /* srand, rand */
+#include <stdlib.h>
+#include <string.h>     /* memset, memcpy */
 #include <time.h>       /* time */
-#include "Screen.h"
-#include "Sound.cpp"
+#include <mutex>        /* call_once */
+#include "Chip8.h"
+#include "Dis.h"
+#include "Jit.h"
+#include "Profile.h"
+#include "Tracer.h"
+#include "Trace.h"
 
 // 1. print sprite operator
 //		put pixels in global screen buffer
@@ -30,39 +36,6 @@
 // SP: stack pointer
 // ST: stack memory, separated from mem
 
-typedef unsigned char byte;
-typedef unsigned short int word;
-typedef unsigned int double_word;
-
-
-bool QUIRK_SH1VAR = true;		// true: V[x]=shift(V[x])+carry, false: V[x]=shift(V[y]) (org)
-bool QUIRK_KEEPIX = true;		// true: IX unchanged after STO/RCL (schip), false: changes
-bool QUIRK_SPR16 = true;		// true: DRAW (x,y)#0=> 16 byte sprite, false: #0=no draw
-
-
-byte V[16];
-word IX;
-word PC;
-word SP;
-byte DT; // delay timer
-byte ST; // sound time
-byte KEY;// current key
-
-
-const int STACK_SIZE = 16;
-word stack[STACK_SIZE];
-
-const int MEM_SIZE		= 0x10000; // 64kB memory
-const int PROG_START	= 0x0200;
-const int PROG_END		= 0x1000;	// using the "reseved" space as well
-const int PROG_MAX_SIZE	= PROG_END - PROG_START;
-byte* mem;
-int prog_size;
-
-// According to one documentation, font is stored in 0x8110
-// I'm putting it in x1000, above code area
-const int FONT_START = 0x1000;
-
 // EXPANSION
 // add all characters, in <200
 // Also test moving fonts to >0x1000 area for large fonts
@@ -103,10 +76,104 @@ const int FONT_START = 0x1000;
 // That's something I probably should do, go through existing code, and optimize with new ops
 
 
-void chip_init() {
-	mem = new byte[MEM_SIZE];
+static const Instr* decode_table(int quirks);
+
+const QuirkProfile quirk_profiles[] = {
+	{ "vip",		QUIRKS_VIP },
+	{ "chip48",		QUIRKS_CHIP48 },
+	{ "schip",		QUIRKS_SCHIP },
+	{ "xochip",		QUIRKS_XOCHIP },
+	{ "default",	QUIRKS_DEFAULT },
+	{ NULL,			0 }
+};
+
+int quirks_parse(const char* s)
+{
+	if(strcmp(s, "auto")==0)
+		return QUIRKS_AUTO;
+	for(const QuirkProfile* p=quirk_profiles; p->name!=NULL; p++)
+		if(strcmp(s, p->name)==0)
+			return p->quirks;
+	char* end;
+	long q = strtol(s, &end, 0);
+	if(*s==0 || *end!=0 || q<0 || q>QUIRK_ALL)
+		return -2;
+	return q;
+}
+
+const char* quirks_name(int quirks)
+{
+	for(const QuirkProfile* p=quirk_profiles; p->name!=NULL; p++)
+		if(p->quirks==quirks)
+			return p->name;
+	return NULL;
+}
+
+Chip8::Chip8()
+{
+	mem = new byte[MEM_SIZE+2]();	// +2: an instruction at 0xFFFF reads one past
+	icache = new const Instr*[PROG_END];
+	prog_size = 0;
+	ops = NULL;
+	quirks = -1;
+
+	sound_start_cb = NULL;
+	sound_check_cb = NULL;
+	sound_pitch_cb = NULL;
+	delay_timer_cb = NULL;
+	user = NULL;
+	jit = NULL;
+	jit_watch = NULL;
+	prof = NULL;
+	tracer = NULL;
+
+	set_quirks(QUIRKS_AUTO);
+	init();
+}
+
+Chip8::~Chip8()
+{
+	delete[] mem;
+	delete[] icache;
+}
+
+// reset to power on state, program has to be loaded again
+void Chip8::init() {
+	memset(mem, 0, MEM_SIZE);
+
+	load_fonts();
+
+	flush_code();
+
+	for( int i=0; i<16; i++)
+		V[i] = 0;
+
+	IX=0;
+	PC=0x200;
+	SP=0;		// stack grow up, SP basically is the size, so when it's 16, it's full, 0 empty
+	DT=0;
+	ST=0;
+	KEY=0;
+	memset(stack, 0, sizeof(stack));
+
+	pitch = 880;	// default
+	memset(pattern, 0, sizeof(pattern));
+	pattern_on = false;
+	rate = 64;		// 4000 samples/s
+
+	cfg.clear();
+	exit_code = 0;
+	halted = false;
+
+	seed(time(NULL));
+
+	screen.init();
+}
 
-	byte fontset[] = {
+// both fonts, below PROG_START
+void Chip8::load_fonts()
+{
+	const byte fontset[] = {
 		0xF0, 0x90, 0x90, 0x90, 0xF0,		// 0
 		0x20, 0x60, 0x20, 0x20, 0x70,		// 1
 		0xF0, 0x10, 0xF0, 0x80, 0xF0,		// 2
@@ -124,20 +191,30 @@ void chip_init() {
 		0xF0, 0x80, 0xF0, 0x80, 0xF0,		// E
 		0xF0, 0x80, 0xF0, 0x80, 0x80		// F
 	};
-	for( int i=0; i<sizeof(fontset); i++)
+	for( size_t i=0; i<sizeof(fontset); i++)
 		mem[FONT_START+i] = fontset[i];
 
-	for( int i=0; i<16; i++)
-		V[i] = 0;
-
-	IX=0;
-	PC=0x200;
-	SP=0;		// stack grow up, SP basically is the size, so when it's 16, it's full, 0 empty
-
-	srand (time(NULL));
-
-	sound_init();
-
+	// SUPER-CHIP has 0-9, A-F as in XO-CHIP (Octo)
+	const byte fontset_big[] = {
+		0xFF, 0xFF, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF,		// 0
+		0x18, 0x78, 0x78, 0x18, 0x18, 0x18, 0x18, 0x18, 0xFF, 0xFF,		// 1
+		0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF,		// 2
+		0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF,		// 3
+		0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0x03, 0x03,		// 4
+		0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF,		// 5
+		0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF,		// 6
+		0xFF, 0xFF, 0x03, 0x03, 0x06, 0x0C, 0x18, 0x18, 0x18, 0x18,		// 7
+		0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF,		// 8
+		0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF,		// 9
+		0x7E, 0xFF, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xC3,		// A
+		0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC,		// B
+		0x3C, 0xFF, 0xC3, 0xC0, 0xC0, 0xC0, 0xC0, 0xC3, 0xFF, 0x3C,		// C
+		0xFC, 0xFE, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFE, 0xFC,		// D
+		0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF,		// E
+		0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xC0, 0xC0		// F
+	};
+	for( size_t i=0; i<sizeof(fontset_big); i++)
+		mem[FONT_BIG_START+i] = fontset_big[i];
 }
 
 // op codes enum
@@ -225,6 +302,12 @@ enum OP_ALU { // 0x8xyP, P=operation
 						//			SC: Vx=Vx<<1 (carry)
 	// 0x8-0xD, 0xF
 };
+
+enum OP_VV { // 0x5xyP, XO-Chip, same idea as the note above, IX not changed
+	SKEQ	= 0x0,		// 5xy0		skip if Vx==Vy
+	STO_VV	= 0x2,		// 5xy2		store Vx..Vy at IX, x>y goes backwards
+	RCL_VV	= 0x3,		// 5xy3		recall Vx..Vy from IX
+};
 // for the shift instructions, if y=0, shift x, if y>0, shift y
 // that way it's automatic
 
@@ -272,37 +355,77 @@ enum OP_SPEC { // 0xFxp
 	BRCHB_V = 0xAE,		// FxAE		Jump V[x] instructions backwards (PC-V[x]*2), V[x]=1: infinte loop
 
 	// XO Chip
-	SET_PV2	= 0x3A,		//			Set Pitch = 4000*2^((Vx-64)/48) Hertz
+	SET_PV2	= 0x3A,		// Fx3A		Set Pitch = 4000*2^((Vx-64)/48) Hertz
+	PLANE_N	= 0x01,		// Fn01		select drawing planes, n=0-3
+						// F002		audio pattern = 16 bytes at IX
+						// F000 nnnn	IX = nnnn, with QUIRK_LONGI (else STOP)
 
 	// COSMAC ELF
 	// EXT_JMP = 0xFF	// FFFF	NNNN	Two word instruction, jump to NNNN
 
 };
 
-// For debugger:
-// basically store every address (nnn) made by JMP, JMPV0, CALL, SETIX
-// when trace prints out, print a "@" to mark it
-const int entry_max = 128;
-word entry[entry_max]; // allow up to 16 entry points recorded
-int entry_cnt = 0;
-int exit_code = 0;
+// static flow of the program just loaded, see Cfg.h
+void Chip8::analyze()
+{
+	cfg.analyze(mem, PROG_END, PROG_START, prog_size, (quirks & QUIRK_LONGI)!=0);
+}
 
-void add_entry(word addr)
+void Chip8::set_quirks(int q)
 {
-	bool exist = false;
-	for(int i=0; i<entry_max; i++)
-		if(entry[i] == addr) {
-			exist = true;
-			break;
-		}
-	if(!exist)
-		entry[entry_cnt++] = addr;
+	quirks_set = q;
+	use_quirks(q==QUIRKS_AUTO ? QUIRKS_DEFAULT : q);
+}
+
+// switch decode tables, everything decoded with the old one goes
+void Chip8::use_quirks(int q)
+{
+	q &= QUIRK_ALL;
+	if(q==quirks && ops!=NULL)
+		return;
+	// F000 nnnn changes the flow walk
+	bool walk = ((q ^ quirks) & QUIRK_LONGI)!=0 && prog_size>0;
+	quirks = q;
+	ops = decode_table(q);
+	flush_code();
+	if(walk)
+		analyze();
+}
+
+// the profile from the opcodes the program uses, only where the flow walk
+// found code, so data that happens to look like an opcode doesn't count
+// XO-CHIP is a superset of SUPER-CHIP, anything else gets the default
+// the walk reads F000 nnnn as XO-CHIP does, as STOP it would end there and
+// miss everything after it, F000 alone doesn't pick xochip
+int Chip8::select_quirks() const
+{
+	Cfg walk;
+	walk.analyze(mem, PROG_END, PROG_START, prog_size, true);
+	bool schip = false;
+	for(int addr=PROG_START; addr<PROG_START+prog_size; addr++) {
+		if(!walk.is_code(addr))
+			continue;
+		word op = (mem[addr]<<8) | mem[addr+1];
+		if((op & 0xF00E)==0x5002				// 5xy2, 5xy3: STO/RCL Vx..Vy
+				|| (op & 0xFFF0)==0x00D0		// 00Dn: scroll up
+				|| (op & 0xF0FF)==0xF001		// Fn01: plane
+				|| op==0xF002					// audio pattern
+				|| (op & 0xF0FF)==0xF03A)		// pitch
+			return QUIRKS_XOCHIP;
+		if((op & 0xFFF0)==0x00C0				// 00Cn: scroll down
+				|| (op>=0x00FB && op<=0x00FF)	// scroll, exit, lores, hires
+				|| (op & 0xF0FF)==0xF030		// big font
+				|| (op & 0xF0FF)==0xF075
+				|| (op & 0xF0FF)==0xF085)		// flag registers
+			schip = true;
+	}
+	return schip ? QUIRKS_SCHIP : QUIRKS_DEFAULT;
 }
 
 // load binary file
 // return true if success
 // false if fail
-bool chip_load_file(const char* filename)
+bool Chip8::load_file(const char* filename)
 {
 	bool ret = false;
 
@@ -313,7 +436,7 @@ bool chip_load_file(const char* filename)
 	} else {
 		fseek(file, 0, SEEK_END);
 		prog_size = ftell(file);
-		printf("ROM size: %d\n", prog_size);
+		TRACE_OPS("ROM size: %d\n", prog_size);
 		rewind(file);
 
 		if (prog_size > PROG_MAX_SIZE) {
@@ -322,6 +445,10 @@ bool chip_load_file(const char* filename)
 		} else {
 			// read program into memory
 			fread(mem+PROG_START, 1, prog_size, file);
+			flush_code();
+			analyze();
+			if(quirks_set==QUIRKS_AUTO)
+				use_quirks(select_quirks());
 			ret = true;
 		}
 		fclose(file);
@@ -329,7 +456,37 @@ bool chip_load_file(const char* filename)
 	return ret;
 }
 
-void chip_dump_mem()
+// forget all decoded instructions
+// call after changing mem[] directly
+void Chip8::flush_code()
+{
+	memset(icache, 0, PROG_END*sizeof(*icache));
+	if(jit!=NULL)
+		jit->flush();
+}
+
+void Chip8::jit_written(word addr)
+{
+	jit->written(addr);
+}
+
+// load program from a buffer
+bool Chip8::load(const byte* data, int size)
+{
+	if(size > PROG_MAX_SIZE) {
+		printf("Program is too large [%d]\n", size);
+		return false;
+	}
+	memcpy(mem+PROG_START, data, size);
+	prog_size = size;
+	flush_code();
+	analyze();
+	if(quirks_set==QUIRKS_AUTO)
+		use_quirks(select_quirks());
+	return true;
+}
+
+void Chip8::dump_mem()
 {
 	printf("mem size=%d", prog_size);
 	for(int i=0; i<prog_size; i++)	{
@@ -341,8 +498,9 @@ void chip_dump_mem()
 	printf("\n");
 }
 
-void print_stack()
+void Chip8::print_stack()
 {
+#if TRACE_LEVEL>=TRACE_LVL_REGS
 	printf("\t[PC:%04X,SP:%02X,stack:(", PC, SP);
 	for(int i=0; i<SP; i++)	{
 		if(i>0)
@@ -350,9 +508,10 @@ void print_stack()
 		printf("%04X", stack[i]);
 	}
 	printf(")]");
+#endif
 }
 
-bool op_ret()
+bool Chip8::op_ret()
 {
 	bool ret = true;
 	if(SP==0) {
@@ -366,24 +525,22 @@ bool op_ret()
 	return ret;
 }
 
-bool op_jmp(word addr)
+bool Chip8::op_jmp(word addr)
 {
 	bool ret = true;
-	add_entry(addr);
 	if(addr>=PROG_END) {
 		printf("Jump outside of memory PC:%04X\n", addr);
 		ret = false;
 	} else {
 		PC = addr;
-		printf("\t[PC:%04X]", PC);
+		TRACE_REGS("\t[PC:%04X]", PC);
 	}
 	return ret;
 }
 
-bool op_call(word addr)
+bool Chip8::op_call(word addr)
 {
 	bool ret = true;
-	add_entry(addr);
 	if(SP>=STACK_SIZE) {
 		printf("Stack full SP:%d\n", SP);
 		ret = false;
@@ -399,70 +556,72 @@ bool op_call(word addr)
 	return ret;
 }
 
-bool op_skip_equal(byte v1, byte v2)
+// over the next instruction, F000 nnnn is 4 bytes with QUIRK_LONGI
+// past FFFF PC wraps, exec1() stops the program there
+template<class Q> bool Chip8::op_skip()
+{
+	if(Q::LONGI && mem[PC]==0xF0 && mem[PC+1]==0x00)
+		PC += 2;
+	PC += 2;
+	return true;
+}
+
+template<class Q> bool Chip8::op_skip_equal(byte v1, byte v2)
 {
 	bool ret = true;
 	if(v1==v2) {
-		PC += 2;
-		if(PC>=PROG_END) {
-			printf("Skip outside memory PC:%04X\n", PC);
-			ret = false;
-		} else
-			printf("\t[?%02X=%02X,PC:%04X]", v1, v2, PC);
+		ret = op_skip<Q>();
+		TRACE_REGS("\t[?%02X=%02X,PC:%04X]", v1, v2, PC);
 	}
 	return ret;
 }
 
 
-bool op_skip_not_equal(byte v1, byte v2)
+template<class Q> bool Chip8::op_skip_not_equal(byte v1, byte v2)
 {
 	bool ret = true;
 	if(v1!=v2) {
-		PC+=2;
-		if(PC>=PROG_END) {
-			printf("Skip outside memory PC:%04X\n", PC);
-			ret = false;
-		} else
-			printf("\t[?%02X=%02X,PC:%04X]", v1, v2, PC);
+		ret = op_skip<Q>();
+		TRACE_REGS("\t[?%02X=%02X,PC:%04X]", v1, v2, PC);
 	}
 	return ret;
 }
 
-void op_set_reg(byte reg, byte val)
+void Chip8::op_set_reg(byte reg, byte val)
 {
 	V[reg] = val;
-	printf("\t[r%01X:%02X]", reg, V[reg]);
+	TRACE_REGS("\t[r%01X:%02X]", reg, V[reg]);
 }
 
-void op_add_reg(byte reg, byte val)
+void Chip8::op_add_reg(byte reg, byte val)
 {
 	V[15] = 0;
 	word sum = (word)V[reg] + (word)val;
 	if(sum>0xFF)
 		V[15] = 1;
 	V[reg] = (byte)(sum & 0xFF);
-	printf("\t[r%01X:%02X,rF:%02X]", reg, V[reg], V[15]);
+	TRACE_REGS("\t[r%01X:%02X,rF:%02X]", reg, V[reg], V[15]);
 }
 
-void op_or_reg(byte reg, byte val)
+void Chip8::op_or_reg(byte reg, byte val)
 {
 	V[reg] |= val;
-	printf("\t[r%01X:%02X]", reg, V[reg]);
+	TRACE_REGS("\t[r%01X:%02X]", reg, V[reg]);
 }
 
-void op_and_reg(byte reg, byte val)
+void Chip8::op_and_reg(byte reg, byte val)
 {
 	V[reg] &= val;
-	printf("\t[r%01X:%02X]", reg, V[reg]);
+	TRACE_REGS("\t[r%01X:%02X]", reg, V[reg]);
 }
 
-void op_xor_reg(byte reg, byte val)
+void Chip8::op_xor_reg(byte reg, byte val)
 {
 	V[reg] ^= val;
-	printf("\t[r%01X:%02X]", reg, V[reg]);
+	TRACE_REGS("\t[r%01X:%02X]", reg, V[reg]);
 }
 
-void op_sub_reg(byte reg, byte val)
+void Chip8::op_sub_reg(byte reg, byte val)
 {
 	// borrow flag
 	word diff = 0x100 + (word)V[reg] - (word)val;
@@ -470,10 +629,10 @@ void op_sub_reg(byte reg, byte val)
 	if((diff & 0x100)==0)
 		V[15]=0;
 	V[reg] = (byte)(diff & 0xFF);
-	printf("\t[r%01X:%02X, rF:%02X]", reg, V[reg], V[15]);
+	TRACE_REGS("\t[r%01X:%02X, rF:%02X]", reg, V[reg], V[15]);
 }
 
-void op_rsub_reg(byte reg, byte val)
+void Chip8::op_rsub_reg(byte reg, byte val)
 {
 	// borrow flag
 	word diff = 0x100 + (word)val - (word)V[reg];
@@ -481,118 +640,166 @@ void op_rsub_reg(byte reg, byte val)
 	if((diff & 0x100)==0)
 		V[15]=0;
 	V[reg] = (byte)(diff & 0xFF);
-	printf("\t[r%01X:%02X, rF:%02X]", reg, V[reg], V[15]);
+	TRACE_REGS("\t[r%01X:%02X, rF:%02X]", reg, V[reg], V[15]);
 }
 
-void op_shr_reg(byte reg, byte val)
+template<class Q> void Chip8::op_shr_reg(byte reg, byte val)
 {
-	if(QUIRK_SH1VAR) {
+	if(Q::SH1VAR) {
 		V[15]=V[reg]&0x1;
 		V[reg] = V[reg]>>1;
 	} else
 		V[reg] = val>>1;
 
-	printf("\t[r%01X:%02X]", reg, V[reg]);
+	TRACE_REGS("\t[r%01X:%02X]", reg, V[reg]);
 }
 
-void op_shl_reg(byte reg, byte val)
+template<class Q> void Chip8::op_shl_reg(byte reg, byte val)
 {
-	if(QUIRK_SH1VAR) {
+	if(Q::SH1VAR) {
 		V[15] = (V[reg]&0x80)==0?0:1;
 		V[reg] = V[reg]<<1; // add flag for 2reg
 	} else
 		V[reg] = val<<1;
 
-	printf("\t[r%01X:%02X]", reg, V[reg]);
+	TRACE_REGS("\t[r%01X:%02X]", reg, V[reg]);
 }
 
-void op_set_ix(word val)
+void Chip8::op_set_ix(word val)
 {
-	add_entry(val);
 	IX = val;
-	printf("\t[IX:%04X]", IX);
+	TRACE_REGS("\t[IX:%04X]", IX);
 }
 
-extern void start_delay_timer(); // from Program.cpp
-
-void op_set_timer(byte val)
+void Chip8::op_set_timer(byte val)
 {
 	DT = val;
-	printf("\t[DT:%02X]", DT);
-	start_delay_timer();
+	TRACE_REGS("\t[DT:%02X]", DT);
+	if(delay_timer_cb)
+		delay_timer_cb(this);
 }
 
-word pitch[] = {
+const word pitch_table[] = {
 	// 0x00-0x0F
 	0,65,73,82,87,98,110,123,131,147,165,175,196,220,247,262,
 	// 0x10-0x1D
 	294,330,349,392,440,494,523,587,659,698,784,880,988,1047
 };
-byte pitch_size = 0x1E;
+const byte pitch_size = 0x1E;
 
-void op_set_pitch(byte val)
+void Chip8::op_set_pitch(byte val)
 {
 	if(val<pitch_size)
-		sound_pitch = pitch[val];
+		pitch = pitch_table[val];
+	if(sound_pitch_cb)
+		sound_pitch_cb(this);
 }
 
-void op_set_sound(byte val)
+void Chip8::op_set_sound(byte val)
 {
 	ST = val;
-	printf("\t[ST:%02X]", ST);
+	TRACE_REGS("\t[ST:%02X]", ST);
 
 	// start sound
-	sound_start(val/60.0);
+	if(sound_start_cb)
+		sound_start_cb(this, val/60.0);
+}
+
+// XO-CHIP, from now on beeps play pattern
+void Chip8::op_set_pattern()
+{
+	for(int i=0; i<16; i++)
+		pattern[i] = mem[(word)(IX+i)];
+	pattern_on = true;
+	if(sound_pitch_cb)
+		sound_pitch_cb(this);
+}
+
+void Chip8::op_set_rate(byte val)
+{
+	rate = val;
+	if(sound_pitch_cb)
+		sound_pitch_cb(this);
 }
 
-void chip_timers_tick()
+void Chip8::timers_tick()
 {
-	printf("TIMERS:");
+	TRACE_FULL("TIMERS:");
 	if(DT>0)
 	{
 		DT--;
-		printf("\t[DT:%02X]", DT);
+		TRACE_FULL("\t[DT:%02X]", DT);
 	}
 	if(ST>0)
 	{
 		ST--;
-		printf("\t[ST:%02X]", ST);
+		TRACE_FULL("\t[ST:%02X]", ST);
 		// check sound, eventuall turn off sound
-		sound_check(); // worried if timer goes out before
+		if(sound_check_cb)
+			sound_check_cb(this); // worried if timer goes out before
 	}
-	printf("\n");
+	TRACE_FULL("\n");
 }
 
-void op_rand(byte reg, byte val)
+// xorshift32, per machine, so a seeded run is repeatable
+void Chip8::seed(unsigned int s)
 {
-	int rnd = rand();
-	printf("\trnd:%d", rnd);
+	rng = s!=0 ? s : 0x2545F491;	// 0 would stay 0
+}
+
+void Chip8::op_rand(byte reg, byte val)
+{
+	unsigned int rnd = rng;
+	rnd ^= rnd<<13;
+	rnd ^= rnd>>17;
+	rnd ^= rnd<<5;
+	rng = rnd;
+	TRACE_FULL("\trnd:%u", rnd);
 	V[reg] = (byte)(rnd & 0xFF) & val;
-	printf("\t[r%01X:%02X]", reg, V[reg]);
+	TRACE_REGS("\t[r%01X:%02X]", reg, V[reg]);
 }
 
-void op_draw(byte x, byte y, byte spr_h)
+template<class Q> void Chip8::op_draw(byte x, byte y, byte spr_h)
 {
 	V[15] = 0;
 
-	// spr_h = sprite hight, i.e. number of bytes
-	if(spr_h==0 && QUIRK_SPR16)
-		spr_h = 16;
+	// the start position wraps around the screen, the sprite is clipped
+	// at the right and bottom edge
+	x %= screen.width;
+	y %= screen.height;
 
-	for(byte i=0; i<spr_h; i++) { // screen_y=y+i
-		word addr = IX+i;
-		byte spr_b = mem[addr];
-		for(byte cnt=0; cnt<8; cnt++) // just shift byte 8 times, screen_x=x+cnt
-		{
-			if((spr_b & 0x80)>0) // set pixel
-				if(scr_xor_pixel(x+cnt, y+i))
+	// SCHP: 16x16, two bytes per row
+	bool big = spr_h==0 && Q::SPR16;
+	int size = big ? 32 : spr_h;	// bytes per plane
+	if(big)
+		spr_h = 16;
+	if(y+spr_h > screen.height)
+		spr_h = screen.height - y;
+
+	// XO-CHIP: a sprite for each selected plane, one after the other at IX
+	// one row at a time: shift, AND for collision, XOR
+	word addr = IX;
+	for(int p=0; p<SCREEN_PLANES; p++) {
+		if(!(screen.planes & 1<<p))
+			continue;
+		if(big)
+			for(byte i=0; i<spr_h; i++) {
+				word a = addr+i*2;
+				scr_row bits = (scr_row)(mem[a]<<8 | mem[(word)(a+1)]) << (SCREEN_ROW_BITS-16);
+				if(screen.xor_row(p, x, y+i, bits))
 					V[15] = 1;
-			spr_b = spr_b<<1;
-		}
+			}
+		else
+			for(byte i=0; i<spr_h; i++) { // screen_y=y+i
+				scr_row bits = (scr_row)mem[(word)(addr+i)] << (SCREEN_ROW_BITS-8);
+				if(screen.xor_row(p, x, y+i, bits))
+					V[15] = 1;
+			}
+		addr += size;
 	}
 }
 
-byte chip_get_key()
+byte Chip8::key_code(byte key)
 {
 	byte ret = 0xFF; // no key
 
@@ -603,7 +810,7 @@ byte chip_get_key()
 	 * zxcv		=> A0BF
 	 */
 
-	switch(KEY) {
+	switch(key) {
 		case '1':	ret = 0x01;		break;
 		case '2':	ret = 0x02;		break;
 		case '3':	ret = 0x03;		break;
@@ -622,45 +829,51 @@ byte chip_get_key()
 		case 'v':	ret = 0x0F;		break;
 		default:	ret = 0xFF;		break;
 	}
-	printf("CHIP_KEY: '%c' %02X => %02X\n", KEY, KEY, ret);
+	return ret;
+}
+
+byte Chip8::get_key()
+{
+	byte ret = key_code(KEY);
+	TRACE_FULL("CHIP_KEY: '%c' %02X => %02X\n", KEY, KEY, ret);
 	return ret;
 }
 
 // return true of ok. return false to quit
-bool op_skip_equal_key(byte val)
+template<class Q> bool Chip8::op_skip_equal_key(byte val)
 {
 	bool ret = true;
 	if(KEY==27)
 		ret = false;
 	else {
-		byte key = chip_get_key();
-		ret = op_skip_equal(key, val);
+		byte key = get_key();
+		ret = op_skip_equal<Q>(key, val);
 	}
 	return ret;
 }
 
-bool op_skip_not_equal_key(byte val)
+template<class Q> bool Chip8::op_skip_not_equal_key(byte val)
 {
 	bool ret = true;
 	if(KEY==27)
 		ret = false;
 	else {
-		byte key = chip_get_key();
-		ret = op_skip_not_equal(key, val);
+		byte key = get_key();
+		ret = op_skip_not_equal<Q>(key, val);
 	}
 	return ret;
 }
 
-void op_wait_key_reg(byte reg)
+void Chip8::op_wait_key_reg(byte reg)
 {
 	if(KEY!=0)
-		V[reg] = chip_get_key();
+		V[reg] = get_key();
 	else
 		PC=PC-2; // redo wait
 }
 
 
-bool op_sto_bcd(byte val)
+template<class Q> bool Chip8::op_sto_bcd(byte val)
 {
 	bool ret = true;
 	// if over memory, return false
@@ -678,26 +891,26 @@ bool op_sto_bcd(byte val)
 	byte hundred = work % 10;
 // 	printf(" hundred:%d", hundred);
 
-	printf("\t[BCD: %d %d %d]", hundred, tens, ones);
+	TRACE_FULL("\t[BCD: %d %d %d]", hundred, tens, ones);
 
-	mem[IX]=hundred;
-	mem[IX+1]=tens;
-	mem[IX+2]=ones;
+	mem_write(IX, hundred);
+	mem_write(IX+1, tens);
+	mem_write(IX+2, ones);
 
-	if(!QUIRK_KEEPIX) // STD: IX changes
+	if(!Q::KEEPIX) // STD: IX changes
 		IX+=3;
 
 	return ret;
 }
 
 
-bool op_sto_mem_reg(byte reg1, byte reg2)
+template<class Q> bool Chip8::op_sto_mem_reg(byte reg1, byte reg2)
 {
 	bool ret = true;
 	unsigned int ix = IX;
 
 // 	printf("\nstore %X..%X @ ix:%X\n", reg1, reg2, ix);
-	printf("\t[%X: ", ix);
+	TRACE_FULL("\t[%X: ", ix);
 
 	for(int i=reg1; i<=reg2; i++)
 	{
@@ -707,26 +920,26 @@ bool op_sto_mem_reg(byte reg1, byte reg2)
 			ret = false;
 			break;
 		} else {
-			mem[ix] = V[i];
-			printf("%X ", mem[ix]);
+			mem_write(ix, V[i]);
+			TRACE_FULL("%X ", mem[ix]);
 			ix++;
 		}
 	}
-	printf("]");
+	TRACE_FULL("]");
 
-	if(!QUIRK_KEEPIX)
+	if(!Q::KEEPIX)
 		IX = ix;
 
 	return ret;
 }
 
-bool op_rcl_mem_reg(byte reg1, byte reg2)
+template<class Q> bool Chip8::op_rcl_mem_reg(byte reg1, byte reg2)
 {
 	bool ret = true;
 	unsigned int ix = IX;
 
 // 	printf("\nrecall %X..%X @ ix:%X\n", reg1, reg2, ix);
-	printf("\t[%X: ", ix);
+	TRACE_FULL("\t[%X: ", ix);
 
 	for(int i=reg1; i<=reg2; i++)
 	{
@@ -737,13 +950,13 @@ bool op_rcl_mem_reg(byte reg1, byte reg2)
 			break;
 		} else {
 			V[i] = mem[ix];
-			printf("%X ", mem[ix]);
+			TRACE_FULL("%X ", mem[ix]);
 			ix++;
 		}
 	}
-	printf("]");
+	TRACE_FULL("]");
 
-	if(!QUIRK_KEEPIX)
+	if(!Q::KEEPIX)
 		IX = ix;
 
 	return ret;
@@ -751,6 +964,25 @@ bool op_rcl_mem_reg(byte reg1, byte reg2)
 
 
 
+// XO-CHIP 5xy2/5xy3: Vx..Vy, either way round, IX unchanged
+bool Chip8::op_sto_range(byte x, byte y)
+{
+	int n = x<y ? y-x : x-y;
+	int dir = x<y ? 1 : -1;
+	for(int i=0; i<=n; i++)
+		mem_write(IX+i, V[x+i*dir]);
+	return true;
+}
+
+bool Chip8::op_rcl_range(byte x, byte y)
+{
+	int n = x<y ? y-x : x-y;
+	int dir = x<y ? 1 : -1;
+	for(int i=0; i<=n; i++)
+		V[x+i*dir] = mem[(word)(IX+i)];
+	return true;
+}
+
 // // Support functions
 // void chip_draw_sprite( byte* sprite,  int length,  int x,  int y)
 // {
@@ -760,250 +992,355 @@ bool op_rcl_mem_reg(byte reg1, byte reg2)
 
 // I need to make functions for each operator to make it readable and manageable
 
+// A quirk mask as a type, the profile the handlers below are built for
+// the tests on it are constants, the compiler drops the branch not taken
+template<int MASK> struct Quirks {
+	static const int mask		= MASK;
+	static const bool SH1VAR	= (MASK & QUIRK_SH1VAR)!=0;
+	static const bool KEEPIX	= (MASK & QUIRK_KEEPIX)!=0;
+	static const bool SPR16		= (MASK & QUIRK_SPR16)!=0;
+	static const bool JMPVX		= (MASK & QUIRK_JMPVX)!=0;
+	static const bool IXCARRY	= (MASK & QUIRK_IXCARRY)!=0;
+	static const bool LONGI		= (MASK & QUIRK_LONGI)!=0;
+};
+
+// Opcode handlers, one per instruction, operands already split out
+// return false to exit, the trace mnemonic is printed by exec1() (Dis.cpp)
+// the ones that depend on a quirk are templates on the profile
+// (a struct so it can be a friend of Chip8 and reach the op_* helpers)
+struct Ops {
+	static bool undef(Chip8& c, const Instr& in)	{ return false; }
+
+	// 00pp
+	static bool scrd(Chip8& c, const Instr& in)		{ c.screen.scroll_down(in.n);	return true; }
+	static bool scru(Chip8& c, const Instr& in)		{ c.screen.scroll_up(in.n);	return true; }
+	static bool nop(Chip8& c, const Instr& in)		{ return true; }
+	static bool cls(Chip8& c, const Instr& in)		{ c.screen.clear();	return true; }
+	static bool ret(Chip8& c, const Instr& in)		{ return c.op_ret(); }
+	static bool rst(Chip8& c, const Instr& in)		{ c.PC = 0x0000;	return true; } // boot into hex monitor
+	// 4 pixels, half that on the lores screen
+	static bool scrr(Chip8& c, const Instr& in)		{ c.screen.scroll_right(c.screen.hires() ? 4 : 2);	return true; }
+	static bool scrl(Chip8& c, const Instr& in)		{ c.screen.scroll_left(c.screen.hires() ? 4 : 2);	return true; }
+	static bool lores(Chip8& c, const Instr& in)	{ c.screen.set_hires(false);	return true; }
+	static bool hires(Chip8& c, const Instr& in)	{ c.screen.set_hires(true);	return true; }
+
+	static bool jmp(Chip8& c, const Instr& in)		{ return c.op_jmp(in.nnn); }
+	static bool call(Chip8& c, const Instr& in)		{ return c.op_call(in.nnn); }
+
+	template<class Q>
+	static bool skeq_vn(Chip8& c, const Instr& in)	{ return c.op_skip_equal<Q>(c.V[in.x], in.nn); }
+	template<class Q>
+	static bool skne_vn(Chip8& c, const Instr& in)	{ return c.op_skip_not_equal<Q>(c.V[in.x], in.nn); }
+	template<class Q>
+	static bool skeq_vv(Chip8& c, const Instr& in)	{ return c.op_skip_equal<Q>(c.V[in.x], c.V[in.y]); }
+	template<class Q>
+	static bool skne_vv(Chip8& c, const Instr& in)	{ return c.op_skip_not_equal<Q>(c.V[in.x], c.V[in.y]); }
+	static bool sto_vv(Chip8& c, const Instr& in)	{ return c.op_sto_range(in.x, in.y); }
+	static bool rcl_vv(Chip8& c, const Instr& in)	{ return c.op_rcl_range(in.x, in.y); }
+
+	static bool set_vn(Chip8& c, const Instr& in)	{ c.op_set_reg(in.x, in.nn);	return true; }
+	static bool add_vn(Chip8& c, const Instr& in)	{ c.op_add_reg(in.x, in.nn);	return true; }
+
+	// 8xyp
+	static bool cp(Chip8& c, const Instr& in)		{ c.op_set_reg(in.x, c.V[in.y]);	return true; }
+	static bool or_(Chip8& c, const Instr& in)		{ c.op_or_reg(in.x, c.V[in.y]);	return true; }
+	static bool and_(Chip8& c, const Instr& in)		{ c.op_and_reg(in.x, c.V[in.y]);	return true; }
+	static bool xor_(Chip8& c, const Instr& in)		{ c.op_xor_reg(in.x, c.V[in.y]);	return true; }
+	static bool add(Chip8& c, const Instr& in)		{ c.op_add_reg(in.x, c.V[in.y]);	return true; }
+	static bool sub(Chip8& c, const Instr& in)		{ c.op_sub_reg(in.x, c.V[in.y]);	return true; }
+	template<class Q>
+	static bool shr(Chip8& c, const Instr& in)		{ c.op_shr_reg<Q>(in.x, c.V[in.y]);	return true; }
+	static bool rsub(Chip8& c, const Instr& in)		{ c.op_rsub_reg(in.x, c.V[in.y]);	return true; }
+	template<class Q>
+	static bool shl(Chip8& c, const Instr& in)		{ c.op_shl_reg<Q>(in.x, c.V[in.y]);	return true; }
+
+	static bool set_in(Chip8& c, const Instr& in)	{ c.op_set_ix(in.nnn);	return true; }
+	template<class Q>
+	static bool jmp_v0n(Chip8& c, const Instr& in)	{ return c.op_jmp(in.nnn + c.V[Q::JMPVX ? in.x : 0]); }
+	static bool rnd_vn(Chip8& c, const Instr& in)	{ c.op_rand(in.x, in.nn);	return true; }
+	template<class Q>
+	static bool draw(Chip8& c, const Instr& in)		{ c.op_draw<Q>(c.V[in.x], c.V[in.y], in.n);	return true; }
+
+	// Expp
+	template<class Q>
+	static bool skeq_kv(Chip8& c, const Instr& in)	{ return c.op_skip_equal_key<Q>(c.V[in.x]); }
+	template<class Q>
+	static bool skne_kv(Chip8& c, const Instr& in)	{ return c.op_skip_not_equal_key<Q>(c.V[in.x]); }
+
+	// Fxpp
+	static bool stop_v(Chip8& c, const Instr& in)	{ c.exit_code = c.V[in.x];	return false; } // exit to emulator
+	// XO-CHIP F000 nnnn, the second word is read here, not decoded
+	static bool long_i(Chip8& c, const Instr& in) {
+		c.IX = c.mem[c.PC]<<8 | c.mem[c.PC+1];
+		c.PC += 2;
+		return true;
+	}
+	static bool plane(Chip8& c, const Instr& in)	{ c.screen.planes = in.x & 3;	return true; }
+	static bool audio(Chip8& c, const Instr& in)	{ c.op_set_pattern();	return true; }
+	static bool rate_v(Chip8& c, const Instr& in)	{ c.op_set_rate(c.V[in.x]);	return true; }
+	static bool get_vt(Chip8& c, const Instr& in)	{ c.op_set_reg(in.x, c.DT);	return true; }
+	static bool wait_vk(Chip8& c, const Instr& in)	{ c.op_wait_key_reg(in.x);	return true; }
+	static bool set_tv(Chip8& c, const Instr& in)	{ c.op_set_timer(c.V[in.x]);	return true; }
+	static bool set_pv(Chip8& c, const Instr& in)	{ c.op_set_pitch(c.V[in.x]);	return true; }
+	static bool set_sv(Chip8& c, const Instr& in)	{ c.op_set_sound(c.V[in.x]);	return true; }
+	// Amiga does carry
+	template<class Q>
+	static bool add_iv(Chip8& c, const Instr& in) {
+		if(Q::IXCARRY)
+			c.V[15] = c.IX + c.V[in.x] > 0xFFF;
+		c.IX += c.V[in.x];
+		return true;
+	}
+	static bool get_if(Chip8& c, const Instr& in)	{ c.IX = FONT_START + c.V[in.x]*5;	return true; }
+	static bool big_if(Chip8& c, const Instr& in)	{ c.IX = FONT_BIG_START + c.V[in.x]*10;	return true; }
+	template<class Q>
+	static bool bcd_iv(Chip8& c, const Instr& in)	{ return c.op_sto_bcd<Q>(c.V[in.x]); }
+	template<class Q>
+	static bool sto_iv(Chip8& c, const Instr& in)	{ return c.op_sto_mem_reg<Q>(0, in.x); }
+	template<class Q>
+	static bool rcl_iv(Chip8& c, const Instr& in)	{ return c.op_rcl_mem_reg<Q>(0, in.x); }
+	static bool out_rsv(Chip8& c, const Instr& in)	{ return true; }
+	static bool in_vrs(Chip8& c, const Instr& in)	{ return true; }
+	static bool set_bv(Chip8& c, const Instr& in)	{ return true; }
+	static bool save_v(Chip8& c, const Instr& in)	{ return true; }
+	static bool load_v(Chip8& c, const Instr& in)	{ return true; }
+
+	template<class Q>
+	static Instr::handler decode(word op);
+	template<class Q>
+	static void build(Instr* tbl);
+	static const Instr* table(int quirks);
+};
+
+// the old nested switch, now only run when a table is built
+template<class Q>
+Instr::handler Ops::decode(word op)
+{
+	byte op1h = op>>12;
+	byte op1l = (op>>8)&0xF;
+	byte op2 = op&0xFF;
+	byte op2h = op2>>4;
+	byte op2l = op2&0xF;
+
+	switch(op1h) {
+		case SYS_OP:
+			if(op1l!=0) // only 0x00pp
+				return undef;
+			if(op2h==OP_SCHP_SCRD)
+				return scrd;
+			if(op2h==OP_XOCHIP_SCRU)
+				return scru;
+			switch(op2) {
+				case NOP:	return nop;
+				case CLS:	return cls;
+				case RET:	return ret;
+				case RST:	return rst;
+				case SCRR:	return scrr;
+				case SCRL:	return scrl;
+				case LORES:	return lores;
+				case HIRES:	return hires;
+			}
+			return undef;
+
+		case JMP_N:		return jmp;
+		case CALL_N:	return call;
+		case SKEQ_VN:	return skeq_vn<Q>;
+		case SKNE_VN:	return skne_vn<Q>;
+		case SKEQ_VV:
+			switch(op2l) {
+				case STO_VV:	return sto_vv;
+				case RCL_VV:	return rcl_vv;
+			}
+			return skeq_vv<Q>;
+		case SET_VN:	return set_vn;
+		case ADD_VN:	return add_vn;
+
+		case ALU_OP:
+			switch(op2l) {
+				case CP:	return cp;
+				case OR:	return or_;
+				case AND:	return and_;
+				case XOR:	return xor_;
+				case ADD:	return add;
+				case SUB:	return sub;
+				case SHR:	return shr<Q>;
+				case RSUB:	return rsub;
+				case SHL:	return shl<Q>;
+			}
+			return undef;
+
+		case SKNE_VV:	return skne_vv<Q>;
+		case SET_IN:	return set_in;
+		case JMP_V0N:	return jmp_v0n<Q>;
+		case RND_VN:	return rnd_vn;
+		case DRAW_VVN:	return draw<Q>;
+
+		case KEY_OP:
+			switch(op2) {
+				case SKEQ_KV:	return skeq_kv<Q>;
+				case SKNE_KV:	return skne_kv<Q>;
+			}
+			return undef;
+
+		case SPEC_OP:
+			if(op==0xF000 && Q::LONGI)
+				return long_i;
+			if(op==0xF002)
+				return audio;
+			switch(op2) {
+				case STOP_V:	return stop_v;
+				case PLANE_N:	return plane;
+				case SET_PV2:	return rate_v;
+				case GET_VT:	return get_vt;
+				case WAIT_VK:	return wait_vk;
+				case SET_TV:	return set_tv;
+				case SET_PV:	return set_pv;
+				case SET_SV:	return set_sv;
+				case ADD_IV:	return add_iv<Q>;
+				case GET_IF:	return get_if;
+				case BIG_IF:	return big_if;
+				case BCD_IV:	return bcd_iv<Q>;
+				case STO_IV:	return sto_iv<Q>;
+				case RCL_IV:	return rcl_iv<Q>;
+				case OUT_RSV:	return out_rsv;
+				case IN_VRS:	return in_vrs;
+				case SET_BV:	return set_bv;
+				case SAVE_V:	return save_v;
+				case LOAD_V:	return load_v;
+			}
+			return undef;
+	}
+	return undef;
+}
+
+template<class Q>
+void Ops::build(Instr* tbl)
+{
+	for(int op=0; op<0x10000; op++) {
+		Instr& in = tbl[op];
+		in.fn	= decode<Q>(op);
+		in.x	= (op>>8)&0xF;
+		in.y	= (op>>4)&0xF;
+		in.n	= op&0xF;
+		in.nn	= op&0xFF;
+		in.nnn	= op&0xFFF;
+	}
+}
+
+// build<Quirks<MASK>> for every mask, indexed by mask
+typedef void (*table_builder)(Instr* tbl);
+
+template<int MASK> struct Builders {
+	static void fill(table_builder* b) {
+		b[MASK] = &Ops::build< Quirks<MASK> >;
+		Builders<MASK-1>::fill(b);
+	}
+};
+template<> struct Builders<-1> {
+	static void fill(table_builder* b) {}
+};
+
+// every opcode word decoded once per quirk mask, shared by all machines
+// (read only), built the first time a machine asks for the mask
+// 64K x 16 bytes = 1MB each
+const Instr* Ops::table(int quirks)
+{
+	static table_builder builders[QUIRK_ALL+1];
+	static Instr* tbls[QUIRK_ALL+1];
+	static std::once_flag listed;
+	static std::once_flag built[QUIRK_ALL+1];
+	std::call_once(listed, []() { Builders<QUIRK_ALL>::fill(builders); });
+	std::call_once(built[quirks], [quirks]() {
+		tbls[quirks] = new Instr[0x10000];
+		builders[quirks](tbls[quirks]);
+	});
+	return tbls[quirks];
+}
+
+static const Instr* decode_table(int quirks)
+{
+	return Ops::table(quirks);
+}
+
 // execute 1
 // return false to exit
 // true for continue execution
-bool chip_exec1()
+bool Chip8::exec1()
 {
-	bool ret = true;
 	if(PC>=(PROG_START+prog_size))
 	{
 		printf("End of program\n");
-		ret = false;
-	} else {
+		return false;
+	}
 
-		printf("%04X:", PC);
-		for(word ent : entry)
-			if(ent==PC)
-			{
-				printf("@");
-				break;
-			}
-		printf("\t");
-
-		byte op1 = mem[PC++];
-		byte op2 = mem[PC++];
-		byte op1h = op1>>4;	// top nibble
-		byte op1l = op1&0xF;	// low nibble
-		byte op2h = op2>>4;
-		byte op2l = op2&0xF;
-		word  op12 = ((op1&0xF)<<8)|(op2);
-
-		printf("%02X%02X\t", op1, op2);
-
-		switch(op1h) {
-			case SYS_OP:	// printf("SYS ");
-				if(op1l==0) { // only 0x00pp
-					if(op2h==OP_SCHP_SCRD)
-						printf("SCRD %d", op2l);
-					else
-						switch(op2) {
-							case NOP:	printf("NOP");
-										break;
-
-							case CLS:	printf("CLS");
-										scr_clear();
-										break;
-
-							case RET:	printf("RET");
-										ret = op_ret();
-										break;
-
-							case RST:	printf("RST");
-										PC = 0x0000; // boot into hex monitor
-										break;
-
-							case SCRR:	printf("SCRR");				break;
-							case SCRL:	printf("SCRL");				break;
-							case LORES:	printf("LORES");			break;
-							case HIRES:	printf("HIRES");			break;
-
-							default:	printf("UNDEF");
-										ret=false;
-										break;
-						}
-				} else {
-					printf("UNDEF");
-					ret = false;
-				}
-				break;
-
-			case JMP_N:		printf("JMP  %04X", op12);
-							ret=op_jmp(op12);
-							break;
-
-			case CALL_N:	printf("CALL %04X", op12);
-							ret=op_call(op12);
-							break;
-
-			case SKEQ_VN:	printf("SKEQ r%01X, #%02X", op1l, op2);
-							ret=op_skip_equal(V[op1l], op2);
-							break;
-
-			case SKNE_VN:	printf("SKNE r%01X, #%02X", op1l, op2);
-							ret=op_skip_not_equal(V[op1l], op2);
-							break;
-
-			case SKEQ_VV:	printf("SKEQ r%01X, r%01X", op1l, op2h);
-							ret=op_skip_equal(V[op1l], V[op2h]);
-							break;
-
-			case SET_VN:	printf("SET  r%01X, #%02X", op1l, op2);
-							op_set_reg(op1l, op2);
-							break;
-
-			case ADD_VN:	printf("ADD  r%01X, #%02X", op1l, op2);
-							op_add_reg(op1l, op2);
-							break;
-
-			case ALU_OP:	// printf("ALU ");
-				switch(op2l) {
-					case CP:	printf("SET  r%01X, r%01X", op1l, op2h);
-								op_set_reg(op1l, V[op2h]);
-								break;
-
-					case OR:	printf("OR   r%01X, r%01X", op1l, op2h);
-								op_or_reg(op1l, V[op2h]);
-								break;
-
-					case AND:	printf("AND  r%01X, r%01X", op1l, op2h);
-								op_and_reg(op1l, V[op2h]);
-								break;
-
-					case XOR:	printf("XOR  r%01X, r%01X", op1l, op2h);
-								op_xor_reg(op1l, V[op2h]);
-								break;
-
-					case ADD:	printf("ADD  r%01X, r%01X", op1l, op2h);
-								op_add_reg(op1l, V[op2h]);
-								break;
-
-					case SUB:	printf("SUB  r%01X, r%01X", op1l, op2h);
-								op_sub_reg(op1l, V[op2h]);
-								break;
-
-					case SHR:	printf("SHR  r%01X, r%01X", op1l, op2h);
-								op_shr_reg(op1l, V[op2h]);
-								break;
-
-					case RSUB:	printf("RSUB r%01X, r%01X", op1l, op2h);
-								op_rsub_reg(op1l, V[op2h]);
-								break;
-
-					case SHL:	printf("SHL  r%01X, r%01X", op1l, op2h);
-								op_shl_reg(op1l, V[op2h]);
-								break;
-
-					default:	printf("UNDEF");
-								ret = false;
-								break;
-				}
-				break;
-
-			case SKNE_VV:	printf("SKNE r%01X, r%01X", op1l, op2h);
-							op_skip_not_equal(V[op1l], V[op2h]);
-							break;
-
-			case SET_IN:	printf("SET  IX, #%04X", op12);
-							op_set_ix(op12);
-							break;
-
-			case JMP_V0N:	printf("JPV0 %04X", op12);
-							op_jmp(op2+V[0]);
-							break;
-
-			case RND_VN:	printf("RAND r%01X, #%02X", op1l, op2);
-							op_rand(op1l, op2);
-							break;
-
-
-			case DRAW_VVN:	printf("DRAW (r%01X,r%01X), M(IX)..#%01X", op1l, op2h, op2l);
-							op_draw(V[op1l], V[op2h], op2l);
-							break;
-
-			case KEY_OP:	// printf("KEY ");
-				switch(op2) {
-					case SKEQ_KV:	printf("SKEQ KEY, r%01X", op1l);
-									// op_skip_equal(KEY, V[op1l]);
-									ret = op_skip_equal_key(V[op1]);
-									break;
-
-					case SKNE_KV:	printf("SKNE KEY, r%01X", op1l);
-									ret = op_skip_not_equal_key(V[op1l]);
-									break;
-
-					default:		printf("UNDEF");
-									ret = false;
-									break;
-				}
-				break;
-
-			case SPEC_OP:	// printf("SPEC ");
-				switch(op2) {
-					case STOP_V:	printf("STOP r%01X", op1l);	// exit to emulator
-									exit_code=V[op1l];
-									ret=false;
-									break;
-
-					case GET_VT:	printf("SET  r%01X, TIMER", op1l);
-									op_set_reg(op1l, DT);
-									break;
-
-					case WAIT_VK:	printf("WAIT r%01X, KEY", op1l);
-									op_wait_key_reg(op1l);
-									break;
-
-					case SET_TV:	printf("SET  TIMER, r%01X", op1l);
-									op_set_timer(V[op1l]);
-									break;
-
-					case SET_PV:	printf("SET  PITCH, r%01X", op1l);
-									op_set_pitch(V[op1l]);
-									break;
-
-					case SET_SV:	printf("SET  SOUND, r%01X", op1l);
-									op_set_sound(V[op1l]);
-									break;
-
-					case ADD_IV:	printf("ADD  IX, r%01X", op1l);
-									// Atari does carry
-									// Add quirk flags instead of emulator mode
-									IX += V[op1l];
-									break;
-
-					case GET_IF:	printf("SET  IX, FONT(r%01X)", op1l);
-									IX = FONT_START + V[op1l]*5;
-									break;
-
-					case BIG_IF:	printf("SET  IX, BIG(r%01X)", op1l);		break;
-
-					case BCD_IV:	printf("BCD  M(IX), r%01X", op1l);
-									ret = op_sto_bcd(V[op1l]);
-									break;
-
-					case STO_IV:	printf("STO  M(IX), r0..r%01X", op1l);
-									ret = op_sto_mem_reg(0, op1l);
-									break;
-
-					case RCL_IV:	printf("RCL  r0..r%01X, M(IX)", op1l);
-									ret = op_rcl_mem_reg(0, op1l);
-									break;
-
-					case OUT_RSV:	printf("OUT  r%01X", op1l);					break;
-					case IN_VRS:	printf("IN   r%01X", op1l);					break;
-					case SET_BV:	printf("SET  BAUD, r%01X", op1l);			break;
-					case SAVE_V:	printf("SAVE r0..r%01X", op1l);				break;
-					case LOAD_V:	printf("LOAD r0..r%01X", op1l);				break;
-
-					default:		printf("UNDEF");
-									ret = false;
-									break;
-				}
-				break;
-		}
+#if TRACE_LEVEL>=TRACE_LVL_OPS
+	printf("%04X:%s\t", PC, cfg.is_label(PC) ? "@" : "");
+#endif
+
+	// decode once per address, mem_write() drops it again
+	word pc = PC;
+	const Instr* in = icache[pc];
+	if(in==NULL)
+		in = icache[pc] = &ops[(mem[pc]<<8) | mem[pc+1]];
+	PC += 2;
+#if TRACE_LEVEL>=TRACE_LVL_OPS
+	char dis[DIS_MAX];
+	dis_1((mem[pc]<<8) | mem[pc+1], dis, NULL,
+		(quirks & QUIRK_LONGI) && mem[pc]==0xF0 && mem[pc+1]==0x00 ? mem[pc+2]<<8 | mem[pc+3] : -1);
+	printf("%02X%02X\t%s", mem[pc], mem[pc+1], dis);
+#endif
+
+	bool ret = in->fn(*this, *in);
+
+	TRACE_OPS("\n");
+	// PC is a word, running off the last bytes of memory wraps it to 0000
+	if(pc>=PROG_END-6 && PC<pc && ret)
+		ret = end_of_memory(pc);
+	return ret;
+}
 
-		printf("\n");
+// the instruction at pc left PC below it: a jump did, or it went past FFFF
+// (a skip, F000 nnnn or the next instruction), that stops the program
+// PC is left on the instruction, the address after it doesn't fit
+bool Chip8::end_of_memory(word pc)
+{
+	word op = (mem[pc]<<8) | mem[pc+1];
+	switch(op>>12) {
+		case 0x0:
+			if(op==0x00EE || op==0x00FD)
+				return true;
+			break;
+		case 0x1:
+		case 0x2:
+		case 0xB:
+			return true;
 	}
-	return ret;
+	printf("End of memory PC:%04X\n", pc);
+	PC = pc;
+	return false;
 }
 
+// run up to max_instr instructions
+// return number executed, the one that stopped the program included, so
+// a stop on the last one gives max_instr too: halted tells them apart
+// with a Jit attached it runs compiled blocks where it can, a Profiler or
+// a Tracer takes over from it
+long long Chip8::run(long long max_instr)
+{
+	if(prof!=NULL)
+		return prof->run(max_instr);
+	if(tracer!=NULL)
+		return tracer->run(max_instr);
+	if(jit!=NULL)
+		return jit->run(max_instr);
+
+	long long cnt = 0;
+	while(cnt<max_instr) {
+		cnt++;
+		if(!exec1()) {
+			halted = true;
+			break;
+		}
+	}
+	return cnt;
+}
@@ -1,6 +1,227 @@
 // Chip8.h
 
-void chip_init();
-void chip_exec1();
+#ifndef CHIP8_H
+#define CHIP8_H
 
+#include <stddef.h>
 
+#include <vector>
+
+#include "Cfg.h"
+#include "Screen.h"
+
+typedef unsigned char byte;
+typedef unsigned short int word;
+typedef unsigned int double_word;
+
+const int STACK_SIZE = 16;
+
+const int MEM_SIZE		= 0x10000; // 64kB memory
+const int PROG_START	= 0x0200;
+const int PROG_END		= MEM_SIZE;	// XO-CHIP programs can use all of it
+const int PROG_MAX_SIZE	= PROG_END - PROG_START;
+
+// According to one documentation, font is stored in 0x8110
+// it was at x1000, above code area, until XO-CHIP programs went past that,
+// now it's in the interpreter area like on the VIP
+const int FONT_START = 0x0050;
+const int FONT_BIG_START = FONT_START + 16*5;	// SUPER-CHIP 8x10 digits, Fx30
+
+class Chip8;
+class Jit;
+class Profiler;
+class Tracer;
+
+// Quirks, where the CHIP-8 variants disagree, as a mask
+// each mask has a decode table of its own with the quirks built into the
+// handlers (Chip8.cpp), so the running program never tests them
+enum QUIRK {
+	QUIRK_SH1VAR	= 0x01,	// 8xy6/8xyE: Vx=shift(Vx), carry in VF (schip), else Vx=shift(Vy) (org)
+	QUIRK_KEEPIX	= 0x02,	// STO/RCL/BCD leave IX unchanged (schip), else IX moves past
+	QUIRK_SPR16		= 0x04,	// Dxy0 draws a 16x16 sprite, else nothing
+	QUIRK_JMPVX		= 0x08,	// Bxnn jumps to xnn+Vx (chip48, schip), else Bnnn to nnn+V0
+	QUIRK_IXCARRY	= 0x10,	// Fx1E sets VF when IX goes past 0xFFF (Amiga)
+	QUIRK_LONGI		= 0x20,	// F000 nnnn: IX=nnnn, skips go over it (xochip), else Fx00 is STOP
+	QUIRK_ALL		= 0x3F,
+};
+
+// named profiles
+// CHIP-8 on the COSMAC VIP, CHIP-48 on the HP48, SUPER-CHIP 1.1, XO-CHIP (Octo),
+// and what this emulator always ran
+const int QUIRKS_VIP		= 0;
+const int QUIRKS_CHIP48		= QUIRK_SH1VAR | QUIRK_JMPVX;
+const int QUIRKS_SCHIP		= QUIRK_SH1VAR | QUIRK_KEEPIX | QUIRK_SPR16 | QUIRK_JMPVX;
+const int QUIRKS_XOCHIP		= QUIRK_SPR16 | QUIRK_LONGI;
+const int QUIRKS_DEFAULT	= QUIRK_SH1VAR | QUIRK_KEEPIX | QUIRK_SPR16;
+const int QUIRKS_AUTO		= -1;		// pick one at load, see Chip8::select_quirks()
+
+struct QuirkProfile {
+	const char* name;
+	int quirks;
+};
+extern const QuirkProfile quirk_profiles[];	// ends with a NULL name
+
+int quirks_parse(const char* s);		// profile name or mask, -2: neither
+const char* quirks_name(int quirks);	// profile name, NULL: not a named one
+
+// One decoded opcode word: handler plus operands
+// nnn/nn/n/x/y as in the opcode comments (1nnn, 3xnn, Dxyn)
+struct Instr {
+	typedef bool (*handler)(Chip8& chip, const Instr& in);
+
+	handler fn;
+	word nnn;
+	byte x;
+	byte y;
+	byte n;
+	byte nn;
+};
+
+
+// One emulated machine: CPU, memory and screen
+// Nothing in here is global, so a process can run as many machines as it wants.
+// Sound and the 60Hz timer belong to the host, the machine only calls back
+// (callbacks may be NULL, e.g. headless runs)
+class Chip8 {
+public:
+	int quirks;				// QUIRK_* mask in effect, see set_quirks()
+
+	byte V[16];
+	word IX;
+	word PC;
+	word SP;
+	byte DT; // delay timer
+	byte ST; // sound time
+	byte KEY;// current key
+
+	word stack[STACK_SIZE];
+
+	byte* mem;
+	int prog_size;
+
+	word pitch;				// sound pitch in Hz, set by SET_PV
+
+	// XO-CHIP sound, once F002 ran the beep plays pattern instead of a tone
+	byte pattern[16];		// 128 1 bit samples
+	bool pattern_on;
+	byte rate;				// Fx3A, pattern at 4000*2^((rate-64)/48) samples/s
+	unsigned int rng;		// RAND state, see seed()
+
+	int exit_code;
+	bool halted;			// run() ran an instruction that stopped the machine
+
+	// jump/call/data targets and basic blocks of the loaded program,
+	// the trace marks labels with "@"
+	Cfg cfg;
+
+	Screen screen;
+
+	// host hooks
+	void (*sound_start_cb)(Chip8* chip, float dur);	// ST was set, dur in seconds
+	void (*sound_check_cb)(Chip8* chip);			// ST ticked down
+	void (*sound_pitch_cb)(Chip8* chip);			// pitch, pattern or rate changed, also mid beep
+	void (*delay_timer_cb)(Chip8* chip);			// DT was set
+	void* user;										// for the host's use
+
+	Jit* jit;				// set by Jit, NULL: interpreter only
+	Profiler* prof;			// set by Profiler, NULL: not profiling
+	Tracer* tracer;			// set by Tracer, NULL: not tracing
+
+	Chip8();
+	~Chip8();
+	Chip8(const Chip8&) = delete;
+	Chip8& operator=(const Chip8&) = delete;
+
+	void init();			// seeds RAND from the clock
+	void seed(unsigned int s);
+	void set_quirks(int q);	// a mask, or QUIRKS_AUTO: select_quirks() at every load
+	bool load_file(const char* filename);
+	bool load(const byte* data, int size);
+	void dump_mem();
+
+	bool exec1();
+	long long run(long long max_instr);
+	void timers_tick();
+
+	void flush_code();
+
+	static byte key_code(byte key);	// host key to CHIP-8 key, 0xFF: not one
+
+	// save states, State.cpp
+	// the full machine (registers, stack, timers, memory, screen, quirks),
+	// not the host hooks
+	void save_state(std::vector<byte>& out) const;
+	bool load_state(const byte* data, int size);
+	bool save_state_file(const char* filename) const;
+	bool load_state_file(const char* filename);
+
+	const Screen& framebuffer() const { return screen; }
+
+private:
+	friend struct Ops;		// opcode handlers, Chip8.cpp
+	friend class Jit;
+
+	const Instr* ops;		// decode table of the quirks, indexed by opcode word
+	int quirks_set;			// what set_quirks() was given
+
+	// decoded instruction per address, NULL: not decoded yet, PROG_END of them
+	// an instruction at addr reads mem[addr] and mem[addr+1], so a write
+	// drops the entries at addr and addr-1
+	// on the heap like mem, as an array it would be 512K of the object and
+	// Batch and Bench keep their machines on the (worker thread) stack
+	const Instr** icache;
+
+	void mem_write(word addr, byte val) {
+		// a word is always below PROG_END, all of memory can be code
+		mem[addr] = val;
+		icache[addr] = NULL;
+		if(addr>0)
+			icache[addr-1] = NULL;
+		if(jit_watch!=NULL && jit_watch[addr])
+			jit_written(addr);
+	}
+	const byte* jit_watch;	// the Jit's, nonzero: it wants to know about a write there
+	void jit_written(word addr);
+
+	void analyze();
+	void load_fonts();
+	int select_quirks() const;
+	void use_quirks(int q);
+	void print_stack();
+	byte get_key();
+	bool end_of_memory(word pc);
+
+	bool op_ret();
+	bool op_jmp(word addr);
+	bool op_call(word addr);
+	template<class Q> bool op_skip();
+	template<class Q> bool op_skip_equal(byte v1, byte v2);
+	template<class Q> bool op_skip_not_equal(byte v1, byte v2);
+	void op_set_reg(byte reg, byte val);
+	void op_add_reg(byte reg, byte val);
+	void op_or_reg(byte reg, byte val);
+	void op_and_reg(byte reg, byte val);
+	void op_xor_reg(byte reg, byte val);
+	void op_sub_reg(byte reg, byte val);
+	void op_rsub_reg(byte reg, byte val);
+	template<class Q> void op_shr_reg(byte reg, byte val);
+	template<class Q> void op_shl_reg(byte reg, byte val);
+	void op_set_ix(word val);
+	void op_set_timer(byte val);
+	void op_set_pitch(byte val);
+	void op_set_sound(byte val);
+	void op_set_pattern();
+	void op_set_rate(byte val);
+	void op_rand(byte reg, byte val);
+	template<class Q> void op_draw(byte x, byte y, byte spr_h);
+	template<class Q> bool op_skip_equal_key(byte val);
+	template<class Q> bool op_skip_not_equal_key(byte val);
+	void op_wait_key_reg(byte reg);
+	template<class Q> bool op_sto_bcd(byte val);
+	template<class Q> bool op_sto_mem_reg(byte reg1, byte reg2);
+	template<class Q> bool op_rcl_mem_reg(byte reg1, byte reg2);
+	bool op_sto_range(byte x, byte y);
+	bool op_rcl_range(byte x, byte y);
+};
+
+#endif
@@ -0,0 +1,227 @@
+// Dis.cpp
+
+// opcode -> mnemonic, see Dis.h
+//
+// a pattern per instruction, mask and match on the opcode word, and a
+// format where %x %y %n are the nibbles (hex), %b nn (hex), %a nnn (hex or
+// label), %l the F000 operand (hex or label) and %d n (decimal). Every opcode word is matched once, into a table.
+
+#include <mutex>        /* call_once */
+
+#include "Dis.h"
+
+struct Pattern {
+	word mask;
+	word match;
+	const char* fmt;
+};
+
+// first match wins, keep in step with Ops::decode() in Chip8.cpp
+static const Pattern patterns[] = {
+	{ 0xFFFF, 0x0000, "NOP" },
+	{ 0xFFF0, 0x00C0, "SCRD %d" },
+	{ 0xFFF0, 0x00D0, "SCRU %d" },
+	{ 0xFFFF, 0x00E0, "CLS" },
+	{ 0xFFFF, 0x00EE, "RET" },
+	{ 0xFFFF, 0x00FB, "SCRR" },
+	{ 0xFFFF, 0x00FC, "SCRL" },
+	{ 0xFFFF, 0x00FD, "RST" },
+	{ 0xFFFF, 0x00FE, "LORES" },
+	{ 0xFFFF, 0x00FF, "HIRES" },
+	{ 0xF000, 0x1000, "JMP  %a" },
+	{ 0xF000, 0x2000, "CALL %a" },
+	{ 0xF000, 0x3000, "SKEQ r%x, #%b" },
+	{ 0xF000, 0x4000, "SKNE r%x, #%b" },
+	{ 0xF00F, 0x5002, "STO  M(IX), r%x..r%y" },
+	{ 0xF00F, 0x5003, "RCL  r%x..r%y, M(IX)" },
+	{ 0xF000, 0x5000, "SKEQ r%x, r%y" },
+	{ 0xF000, 0x6000, "SET  r%x, #%b" },
+	{ 0xF000, 0x7000, "ADD  r%x, #%b" },
+	{ 0xF00F, 0x8000, "SET  r%x, r%y" },
+	{ 0xF00F, 0x8001, "OR   r%x, r%y" },
+	{ 0xF00F, 0x8002, "AND  r%x, r%y" },
+	{ 0xF00F, 0x8003, "XOR  r%x, r%y" },
+	{ 0xF00F, 0x8004, "ADD  r%x, r%y" },
+	{ 0xF00F, 0x8005, "SUB  r%x, r%y" },
+	{ 0xF00F, 0x8006, "SHR  r%x, r%y" },
+	{ 0xF00F, 0x8007, "RSUB r%x, r%y" },
+	{ 0xF00F, 0x800E, "SHL  r%x, r%y" },
+	{ 0xF000, 0x9000, "SKNE r%x, r%y" },
+	{ 0xF000, 0xA000, "SET  IX, #%a" },
+	{ 0xF000, 0xB000, "JPV0 %a" },
+	{ 0xF000, 0xC000, "RAND r%x, #%b" },
+	{ 0xF000, 0xD000, "DRAW (r%x,r%y), M(IX)..#%n" },
+	{ 0xF0FF, 0xE09E, "SKEQ KEY, r%x" },
+	{ 0xF0FF, 0xE0A1, "SKNE KEY, r%x" },
+	{ 0xF0FF, 0xF000, "STOP r%x" },
+	{ 0xF0FF, 0xF001, "SET  PLANE, #%x" },
+	{ 0xFFFF, 0xF002, "SET  AUDIO, M(IX)" },
+	{ 0xF0FF, 0xF007, "SET  r%x, TIMER" },
+	{ 0xF0FF, 0xF00A, "WAIT r%x, KEY" },
+	{ 0xF0FF, 0xF015, "SET  TIMER, r%x" },
+	{ 0xF0FF, 0xF017, "SET  PITCH, r%x" },
+	{ 0xF0FF, 0xF018, "SET  SOUND, r%x" },
+	{ 0xF0FF, 0xF01E, "ADD  IX, r%x" },
+	{ 0xF0FF, 0xF029, "SET  IX, FONT(r%x)" },
+	{ 0xF0FF, 0xF030, "SET  IX, BIG(r%x)" },
+	{ 0xF0FF, 0xF033, "BCD  M(IX), r%x" },
+	{ 0xF0FF, 0xF03A, "SET  RATE, r%x" },
+	{ 0xF0FF, 0xF055, "STO  M(IX), r0..r%x" },
+	{ 0xF0FF, 0xF065, "RCL  r0..r%x, M(IX)" },
+	{ 0xF0FF, 0xF070, "OUT  r%x" },
+	{ 0xF0FF, 0xF071, "IN   r%x" },
+	{ 0xF0FF, 0xF072, "SET  BAUD, r%x" },
+	{ 0xF0FF, 0xF075, "SAVE r0..r%x" },
+	{ 0xF0FF, 0xF085, "LOAD r0..r%x" },
+	{ 0x0000, 0x0000, "UNDEF" },
+};
+
+static const char hex[] = "0123456789ABCDEF";
+
+// pattern index per opcode word, 64kB, shared and read only
+static const byte* dis_table()
+{
+	static byte* tbl = NULL;
+	static std::once_flag built;
+	std::call_once(built, []() {
+		tbl = new byte[0x10000];
+		for(int op=0; op<0x10000; op++) {
+			int i = 0;
+			while((op & patterns[i].mask)!=patterns[i].match)
+				i++;
+			tbl[op] = i;
+		}
+	});
+	return tbl;
+}
+
+static char* put_hex(char* p, int v, int digits)
+{
+	for(int s=(digits-1)*4; s>=0; s-=4)
+		*p++ = hex[(v>>s) & 0xF];
+	return p;
+}
+
+static char* put_str(char* p, const char* s)
+{
+	while(*s)
+		*p++ = *s++;
+	return p;
+}
+
+int dis_label(const Cfg& cfg, int addr, char* buf)
+{
+	int f = cfg.at(addr);
+	const char* prefix;
+	if(f & Cfg::CALL)
+		prefix = "sub_";
+	else if(f & (Cfg::JUMP | Cfg::TABLE))
+		prefix = "loc_";
+	else if(f & Cfg::DATA)
+		prefix = "data_";
+	else {
+		buf[0] = 0;
+		return 0;
+	}
+	char* p = put_str(buf, prefix);
+	p = put_hex(p, addr, addr<0x1000 ? 3 : 4);
+	*p = 0;
+	return p-buf;
+}
+
+int dis_1(word op, char* buf, const Cfg* labels, int operand)
+{
+	static const byte* tbl = dis_table();
+	const char* f = patterns[tbl[op]].fmt;
+	char* p = buf;
+	char label[DIS_MAX];
+
+	if(op==0xF000 && operand>=0)
+		f = "SET  IX, #%l";
+
+	while(*f) {
+		if(*f!='%') {
+			*p++ = *f++;
+			continue;
+		}
+		f++;
+		switch(*f++) {
+			case 'x':	*p++ = hex[(op>>8) & 0xF];	break;
+			case 'y':	*p++ = hex[(op>>4) & 0xF];	break;
+			case 'n':	*p++ = hex[op & 0xF];		break;
+			case 'b':	p = put_hex(p, op & 0xFF, 2);	break;
+			case 'd':
+				if((op & 0xF)>=10)
+					*p++ = '1';
+				*p++ = '0' + (op & 0xF)%10;
+				break;
+			case 'a':
+			case 'l': {
+				int addr = f[-1]=='a' ? op & 0xFFF : operand;
+				if(labels==NULL || dis_label(*labels, addr, label)==0)
+					p = put_hex(p, addr, 4);
+				else {
+					if(p>buf && p[-1]=='#')		// SET IX, data_202
+						p--;
+					p = put_str(p, label);
+				}
+				break;
+			}
+		}
+	}
+	*p = 0;
+	return p-buf;
+}
+
+void dis_mem(const byte* mem, int start, int end, const Cfg& cfg, std::string& out)
+{
+	char line[DIS_MAX+16];
+	char label[DIS_MAX];
+	int data_cnt = 0;		// bytes on the current .byte row
+
+	int addr = start;
+	while(addr<end) {
+		if(dis_label(cfg, addr, label)>0) {
+			if(data_cnt>0)
+				out += '\n';
+			data_cnt = 0;
+			out += label;
+			out += ":\n";
+		}
+
+		char* p = put_hex(line, addr, 4);
+		if(cfg.is_code(addr) && addr+1<end) {
+			if(data_cnt>0)
+				out += '\n';
+			data_cnt = 0;
+			word op = mem[addr]<<8 | mem[addr+1];
+			int len = addr+3<end ? cfg.length(mem, addr) : 2;
+			int operand = len==4 ? mem[addr+2]<<8 | mem[addr+3] : -1;
+			*p++ = '\t';
+			p = put_hex(p, op, 4);
+			if(len==4)
+				p = put_hex(p, operand, 4);
+			*p++ = '\t';
+			p += dis_1(op, p, &cfg, operand);
+			*p++ = '\n';
+			out.append(line, p-line);
+			addr += len;
+			continue;
+		}
+
+		if(data_cnt==0) {
+			p = put_str(p, "\t\t.byte #");
+			out.append(line, p-line);
+		} else
+			out += ", #";
+		p = put_hex(line, mem[addr], 2);
+		out.append(line, 2);
+		if(++data_cnt==8) {
+			out += '\n';
+			data_cnt = 0;
+		}
+		addr++;
+	}
+	if(data_cnt>0)
+		out += '\n';
+}
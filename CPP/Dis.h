@@ -0,0 +1,30 @@
+// Dis.h
+
+#ifndef DIS_H
+#define DIS_H
+
+#include <string>
+
+#include "Cfg.h"
+#include "Chip8.h"
+
+// Disassembler, no machine needed, table driven, no stdio
+// mnemonics are the ones the trace prints (TRACE=1)
+
+const int DIS_MAX = 32;		// longest dis_1() text, with the 0
+
+// one instruction into buf (DIS_MAX bytes), returns the length
+// with labels, addresses that have one are printed by name (sub_2A4, ...)
+// operand: the word after F000, it is then XO-CHIP SET IX, #nnnn
+int dis_1(word op, char* buf, const Cfg* labels=NULL, int operand=-1);
+
+// label of addr into buf (DIS_MAX bytes): sub_ (CALL), loc_ (JMP, Bnnn), data_ (Annn, F000 nnnn)
+// returns the length, 0 when addr has none
+int dis_label(const Cfg& cfg, int addr, char* buf);
+
+// listing of mem[start, end), appended to out
+// code as ADDR, opcode word, mnemonic, what the walk didn't reach as .byte rows,
+// a label line before every labelled address
+void dis_mem(const byte* mem, int start, int end, const Cfg& cfg, std::string& out);
+
+#endif
@@ -0,0 +1,140 @@
+// Disasm.cpp
+
+// Disassemble ROMs without running them, see Dis.h
+// one listing per ROM, all to stdout, or ROM.asm files in a directory (-o)
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "Cfg.h"
+#include "Dis.h"
+
+std::vector<std::string> roms;
+const char* out_dir = NULL;
+bool xo = false;				// -x: F000 nnnn is XO-CHIP long IX, not STOP
+
+
+double elapsed(timespec* t0, timespec* t1)
+{
+	return (t1->tv_sec - t0->tv_sec) + (t1->tv_nsec - t0->tv_nsec)/1e9;
+}
+
+void add_dir(const char* path)
+{
+	DIR* dir = opendir(path);
+	if(dir==NULL)
+		return;
+	std::vector<std::string> files;
+	while(dirent* ent = readdir(dir)) {
+		std::string file = std::string(path) + "/" + ent->d_name;
+		struct stat st;
+		if(stat(file.c_str(), &st)==0 && S_ISREG(st.st_mode))
+			files.push_back(file);
+	}
+	closedir(dir);
+	std::sort(files.begin(), files.end());
+	roms.insert(roms.end(), files.begin(), files.end());
+}
+
+// the ROM at PROG_START in a zeroed memory image, like Chip8::load
+// mem needs PROG_END+1 bytes, one more is read to tell a ROM that's too big
+bool read_rom(const std::string& name, byte* mem, int& size)
+{
+	FILE* file = fopen(name.c_str(), "rb");
+	if(file==NULL) {
+		fprintf(stderr, "File not found [%s]\n", name.c_str());
+		return false;
+	}
+	size = fread(mem+PROG_START, 1, PROG_MAX_SIZE+1, file);
+	fclose(file);
+	if(size>PROG_MAX_SIZE) {
+		fprintf(stderr, "File is too large [%s]\n", name.c_str());
+		return false;
+	}
+	return true;
+}
+
+void usage(const char* name)
+{
+	printf("usage: %s [-o dir] [-x] rom|dir ...\n", name);
+	printf("\t-o\twrite dir/<rom>.asm per ROM instead of everything to stdout\n");
+	printf("\t-x\tXO-CHIP, F000 nnnn is SET IX, #nnnn (4 bytes)\n");
+}
+
+int main(int argc, char** argv)
+{
+	for(int i=1; i<argc; i++) {
+		char* arg = argv[i];
+		if(strcmp(arg, "-o")==0 && i+1<argc)
+			out_dir = argv[++i];
+		else if(strcmp(arg, "-x")==0)
+			xo = true;
+		else if(arg[0]=='-') {
+			usage(argv[0]);
+			return 1;
+		} else {
+			struct stat st;
+			if(stat(arg, &st)==0 && S_ISDIR(st.st_mode))
+				add_dir(arg);
+			else
+				roms.push_back(arg);
+		}
+	}
+	if(roms.empty()) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	std::vector<byte> mem(PROG_END+1);
+	std::string out;
+	Cfg cfg;
+	int failed = 0;
+	long long bytes = 0;
+	timespec t0, t1;
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for(const std::string& rom : roms) {
+		int size;
+		std::fill(mem.begin(), mem.end(), 0);
+		if(!read_rom(rom, mem.data(), size)) {
+			failed++;
+			continue;
+		}
+		cfg.analyze(mem.data(), PROG_END, PROG_START, size, xo);
+
+		char head[256];
+		int n = snprintf(head, sizeof(head), "; %s: %d bytes, %d code, %zu blocks\n",
+				rom.c_str(), size, cfg.code_bytes(), cfg.blocks.size());
+		out.assign(head, std::min(n, (int)sizeof(head)-1));
+		dis_mem(mem.data(), PROG_START, PROG_START+size, cfg, out);
+		bytes += size;
+
+		if(out_dir==NULL) {
+			out += '\n';
+			fwrite(out.data(), 1, out.size(), stdout);
+			continue;
+		}
+		std::string base = rom.substr(rom.find_last_of('/')+1);
+		std::string path = std::string(out_dir) + "/" + base + ".asm";
+		FILE* file = fopen(path.c_str(), "w");
+		if(file==NULL || fwrite(out.data(), 1, out.size(), file)!=out.size()) {
+			fprintf(stderr, "Can't write [%s]\n", path.c_str());
+			failed++;
+		}
+		if(file!=NULL)
+			fclose(file);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+
+	fprintf(stderr, "DISASM: roms=%zu failed=%d bytes=%lld time=%.3fs\n",
+			roms.size(), failed, bytes, elapsed(&t0, &t1));
+	return failed>0 ? 1 : 0;
+}
@@ -0,0 +1,165 @@
+// display.cpp
+
+// GL window for a Screen buffer
+
+#include <stdio.h>
+#include <string.h>
+// #include <stdlib.h>
+#include <GL/freeglut.h>
+#include <GL/glut.h>  // GLUT, include glu.h and gl.h
+
+#include "Display.h"
+
+// trouble converting the functions to a class, static or otherwise
+// because of the function pointers
+// so there's one window per process, showing the screen given to scr_start
+static Screen* scr_screen = NULL;
+
+float scr_pixel_red;
+float scr_pixel_green;
+float scr_pixel_blue;
+
+
+// the screen is drawn as one texture, RGBA per pixel, on one quad
+// so a redraw costs the same however many pixels are set
+static GLuint scr_tex = 0;
+static int scr_tex_w = 0;
+static int scr_tex_h = 0;
+static unsigned char* scr_colors = NULL;	// one unpacked row, color per pixel
+static unsigned char* scr_pixels = NULL;	// the texture, RGBA
+
+// RGBA per color (XO-CHIP planes), 0 lets the background through,
+// 1 is scr_pixel_*, filled in by scr_start
+static unsigned char scr_palette[4][4] = {
+	{ 0x00, 0x00, 0x00, 0x00 },
+	{ 0xFF, 0xFF, 0xFF, 0xFF },
+	{ 0xFF, 0x99, 0x00, 0xFF },
+	{ 0x99, 0x33, 0x00, 0xFF },
+};
+static unsigned long long scr_pending = 0;	// rows not uploaded yet, see scr_update
+
+static void scr_tex_init(int w, int h) {
+	if(scr_tex==0)
+		glGenTextures(1, &scr_tex);
+	glBindTexture(GL_TEXTURE_2D, scr_tex);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+
+	delete[] scr_colors;
+	delete[] scr_pixels;
+	scr_colors = new unsigned char[w];
+	scr_pixels = new unsigned char[w*h*4];
+	scr_tex_w = w;
+	scr_tex_h = h;
+	scr_pending = ~0ULL;
+}
+
+// rows changed this frame, redrawn on the next display
+void scr_update(unsigned long long dirty) {
+	scr_pending |= dirty;
+	glutPostRedisplay();
+}
+
+// upload each run of changed rows, the rest of the texture stays
+static void scr_tex_upload(Screen* scr) {
+	int y = 0;
+	while(y<scr->height) {
+		if((scr_pending & (1ULL<<y))==0) {
+			y++;
+			continue;
+		}
+		int y0 = y;
+		for(; y<scr->height && (scr_pending & (1ULL<<y)); y++) {
+			scr->unpack_row(y, scr_colors);
+			unsigned char* out = scr_pixels + y*scr->width*4;
+			for(int x=0; x<scr->width; x++, out+=4)
+				memcpy(out, scr_palette[scr_colors[x]], 4);
+		}
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, y0, scr->width, y-y0,
+				GL_RGBA, GL_UNSIGNED_BYTE, scr_pixels + y0*scr->width*4);
+	}
+	scr_pending = 0;
+}
+
+void scr_display() {
+	Screen* scr = scr_screen;
+
+	// screen size can change (hires), the texture follows
+	if(scr->width!=scr_tex_w || scr->height!=scr_tex_h)
+		scr_tex_init(scr->width, scr->height);
+
+	// Clear the color buffer (background)
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+
+	// set pixels are opaque (alpha 0xFF), the rest lets the background through
+	glBindTexture(GL_TEXTURE_2D, scr_tex);
+	scr_tex_upload(scr);
+
+	glEnable(GL_TEXTURE_2D);
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
+
+	// GL range is -1..1, origin in the center, y up
+	// texture row 0 is the top screen row
+	glBegin(GL_QUADS);
+	glColor3f(1.0f, 1.0f, 1.0f);
+	glTexCoord2f(0.0f, 0.0f);	glVertex2f(-1.0f,  1.0f);
+	glTexCoord2f(1.0f, 0.0f);	glVertex2f( 1.0f,  1.0f);
+	glTexCoord2f(1.0f, 1.0f);	glVertex2f( 1.0f, -1.0f);
+	glTexCoord2f(0.0f, 1.0f);	glVertex2f(-1.0f, -1.0f);
+	glEnd();
+
+	glDisable(GL_BLEND);
+	glDisable(GL_TEXTURE_2D);
+	//    	glFlush();  // Render now
+	glutSwapBuffers();		// double buffering swap
+}
+
+
+// void scr_idle() {
+// 	glutPostRedisplay();
+// }
+
+void scr_start(int argc, char** argv, Screen* screen) { // , void(*callback)(), void(*timer)(int)) {
+	scr_screen = screen;
+
+	scr_pixel_red = 1.0f;
+	scr_pixel_green = 1.0f;
+	scr_pixel_blue = 0.99f;
+	scr_palette[1][0] = scr_pixel_red*0xFF;
+	scr_palette[1][1] = scr_pixel_green*0xFF;
+	scr_palette[1][2] = scr_pixel_blue*0xFF;
+
+	glutInit(&argc, argv);
+
+	// double buffer slows it down... for wahtever reason
+	glutInitDisplayMode(GLUT_DOUBLE | GLUT_RGB | GLUT_DEPTH);
+
+	glutCreateWindow("Chip8");
+	glutInitWindowSize(screen->width*10, screen->height*10);
+	glutInitWindowPosition(50, 50);
+	glutReshapeWindow(screen->width*10, screen->height*10);
+	glClearColor(0.2f, 0.2f, 0.2f, 1.0f); // Set background color to black and opaque
+
+	glutDisplayFunc(scr_display);
+
+	// glutReshapeFunc(fn)
+	// glutKeyboardFunc(fn)
+	// glutSpecialFunc(fn)
+	// glutMouseFunc(fn)
+
+	// glutIdleFunc(scr_display); // dirty trick to make refresh the idel function
+	// 	glutIdleFunc(scr_idle); // more accurate way of doing it
+
+// 	glutIdleFunc(callback); // screen call back
+//
+// 	glut
+// 	glutTimerFunc(1000.0/60.0, timer, 0);	// 60 times a second
+
+// 	glutMainLoop();           				// Enter the event-processing loop
+}
@@ -0,0 +1,16 @@
+// Display.h
+
+#ifndef DISPLAY_H
+#define DISPLAY_H
+
+#include "Screen.h"
+
+extern float scr_pixel_red;
+extern float scr_pixel_green;
+extern float scr_pixel_blue;
+
+void scr_display();
+void scr_update(unsigned long long dirty);	// Screen::take_dirty() rows, once per frame
+void scr_start(int argc, char** argv, Screen* screen);
+
+#endif
@@ -0,0 +1,104 @@
+// Input.cpp
+
+#include <stdio.h>
+#include <string.h>
+
+#include "Input.h"
+
+static const char INPUT_MAGIC[4] = { 'C', '8', 'I', 'N' };
+static const int INPUT_VERSION = 1;
+
+InputLog::InputLog()
+{
+	seed = 0;
+	instr_per_frame = 0;
+	next = 0;
+}
+
+// frames only go forward in the log, a change while rewound counts as now
+void InputLog::record(long long frame, byte key)
+{
+	if(!events.empty() && frame<events.back().frame)
+		frame = events.back().frame;
+	Event e = { frame, key };
+	events.push_back(e);
+}
+
+static void put16(FILE* f, int v)	{ fputc(v & 0xFF, f); fputc((v>>8) & 0xFF, f); }
+static void put32(FILE* f, unsigned int v)	{ put16(f, v & 0xFFFF); put16(f, (v>>16) & 0xFFFF); }
+
+static int get16(FILE* f)			{ int v = fgetc(f); return v | fgetc(f)<<8; }
+static unsigned int get32(FILE* f)	{ unsigned int v = get16(f); return v | (unsigned int)get16(f)<<16; }
+
+bool InputLog::save(const char* filename) const
+{
+	FILE* file = fopen(filename, "wb");
+	if(file==NULL) {
+		printf("Can't write [%s]\n", filename);
+		return false;
+	}
+	fwrite(INPUT_MAGIC, 1, 4, file);
+	put16(file, INPUT_VERSION);
+	put32(file, seed);
+	put16(file, instr_per_frame);
+
+	long long last = 0;
+	for(const Event& e : events) {
+		unsigned long long d = e.frame - last;
+		last = e.frame;
+		while(d>=0x80) {
+			fputc((d & 0x7F) | 0x80, file);
+			d >>= 7;
+		}
+		fputc(d, file);
+		fputc(e.key, file);
+	}
+	return fclose(file)==0;
+}
+
+bool InputLog::load(const char* filename)
+{
+	FILE* file = fopen(filename, "rb");
+	if(file==NULL) {
+		printf("File not found [%s]\n", filename);
+		return false;
+	}
+	char magic[4];
+	if(fread(magic, 1, 4, file)!=4 || memcmp(magic, INPUT_MAGIC, 4)!=0 || get16(file)!=INPUT_VERSION) {
+		printf("Not an input recording [%s]\n", filename);
+		fclose(file);
+		return false;
+	}
+	seed = get32(file);
+	instr_per_frame = get16(file);
+
+	events.clear();
+	next = 0;
+	long long frame = 0;
+	while(true) {
+		unsigned long long d = 0;
+		int shift = 0;
+		int c;
+		while((c = fgetc(file))!=EOF && (c & 0x80)) {
+			d |= (unsigned long long)(c & 0x7F) << shift;
+			shift += 7;
+		}
+		if(c==EOF)
+			break;
+		d |= (unsigned long long)c << shift;
+		int key = fgetc(file);
+		if(key==EOF)
+			break;
+		frame += d;
+		Event e = { frame, (byte)key };
+		events.push_back(e);
+	}
+	fclose(file);
+	return true;
+}
+
+void InputLog::play(long long frame, Chip8& chip)
+{
+	while(next<events.size() && events[next].frame<=frame)
+		chip.KEY = events[next++].key;
+}
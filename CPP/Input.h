@@ -0,0 +1,48 @@
+// Input.h
+
+#ifndef INPUT_H
+#define INPUT_H
+
+#include <vector>
+
+#include "Chip8.h"
+
+// Recorded key input of one run, to play it back exactly
+// KEY changes are kept with the frame they happened before, plus the RAND
+// seed and instructions per frame, which is everything a run depends on.
+//
+// file, little endian:
+//	"C8IN" version:16 seed:32 instr_per_frame:16
+//	per change: frames since the last change (varint), new KEY (0: released)
+//
+// usage, recording:
+//	log.seed = s; chip.seed(s);
+//	log.record(frame, key);			// from the key callbacks
+//	log.save("run.c8i");
+// playing back:
+//	log.load("run.c8i"); chip.seed(log.seed);
+//	log.play(frame, chip);			// before each frame
+class InputLog {
+public:
+	unsigned int seed;
+	int instr_per_frame;
+
+	InputLog();
+
+	void record(long long frame, byte key);
+	bool save(const char* filename) const;
+
+	bool load(const char* filename);
+	void play(long long frame, Chip8& chip);	// set KEY for changes up to frame
+	bool done() const { return next>=events.size(); }
+
+private:
+	struct Event {
+		long long frame;
+		byte key;
+	};
+	std::vector<Event> events;
+	size_t next;				// playback position
+};
+
+#endif
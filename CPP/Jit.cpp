@@ -0,0 +1,446 @@
+// Jit.cpp
+
+// x86-64 code generation for Chip8 blocks, see Jit.h
+// System V calling convention: the block gets the Chip8* in rdi, returns nothing
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "Jit.h"
+
+// x86-64 register numbers
+enum HOST_REG {
+	RAX=0, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+	R8, R9, R10, R11, R12, R13, R14, R15,
+	NO_REG = -1
+};
+
+// host registers for guest V/IX, caller saved first
+// rax is scratch, rdi holds the Chip8*
+static const int pool[] = { RSI, RCX, RDX, R8, R9, R10, R11, RBX, RBP, R12, R13, R14, R15 };
+static const int pool_size = sizeof(pool)/sizeof(pool[0]);
+
+static bool callee_saved(int r)
+{
+	return r==RBX || r==RBP || r>=R12;
+}
+
+// tiny x86-64 emitter, only what the blocks need
+// all arithmetic is 32 bit, guest values are kept zero extended
+struct Emit {
+	unsigned char* p;
+
+	void b(int v)	{ *p++ = v; }
+	void w(int v)	{ b(v & 0xFF); b((v>>8) & 0xFF); }
+	void d(int v)	{ w(v & 0xFFFF); w((v>>16) & 0xFFFF); }
+
+	// REX prefix if any extended register, or always for byte registers
+	void rex(int reg, int rm, bool force=false) {
+		int v = 0x40 | ((reg>>3)<<2) | (rm>>3);
+		if(v!=0x40 || force)
+			b(v);
+	}
+	// ModRM for [rdi+disp32]
+	void at_rdi(int reg, int disp) {
+		b(0x80 | (reg&7)<<3 | RDI);
+		d(disp);
+	}
+
+	// op r/m32, r32
+	void rr(int op, int dst, int src) {
+		rex(src, dst);
+		b(op);
+		b(0xC0 | (src&7)<<3 | (dst&7));
+	}
+	void mov(int dst, int src)	{ if(dst!=src) rr(0x89, dst, src); }
+	void add(int dst, int src)	{ rr(0x01, dst, src); }
+	void or_(int dst, int src)	{ rr(0x09, dst, src); }
+	void and_(int dst, int src)	{ rr(0x21, dst, src); }
+	void sub(int dst, int src)	{ rr(0x29, dst, src); }
+	void xor_(int dst, int src)	{ rr(0x31, dst, src); }
+
+	// op r/m32, imm32 (81 /digit)
+	void ri(int digit, int dst, int imm) {
+		rex(0, dst);
+		b(0x81);
+		b(0xC0 | digit<<3 | (dst&7));
+		d(imm);
+	}
+	void add_i(int dst, int imm)	{ ri(0, dst, imm); }
+	void and_i(int dst, int imm)	{ ri(4, dst, imm); }
+
+	// shl/shr r/m32, imm8 (C1 /4, /5)
+	void shift(int digit, int dst, int n) {
+		rex(0, dst);
+		b(0xC1);
+		b(0xC0 | digit<<3 | (dst&7));
+		b(n);
+	}
+	void shl(int dst, int n)	{ shift(4, dst, n); }
+	void shr(int dst, int n)	{ shift(5, dst, n); }
+
+	void mov_i(int dst, int imm) {
+		rex(0, dst);
+		b(0xB8 + (dst&7));
+		d(imm);
+	}
+	// movzx r32, al
+	void movzx_al(int dst) {
+		rex(dst, RAX);
+		b(0x0F); b(0xB6);
+		b(0xC0 | (dst&7)<<3 | RAX);
+	}
+
+	// loads/stores relative to the Chip8* in rdi
+	void load_b(int dst, int disp)	{ rex(dst, RDI); b(0x0F); b(0xB6); at_rdi(dst, disp); }
+	void load_w(int dst, int disp)	{ rex(dst, RDI); b(0x0F); b(0xB7); at_rdi(dst, disp); }
+	void store_b(int src, int disp)	{ rex(src, RDI, true); b(0x88); at_rdi(src, disp); }
+	void store_w(int src, int disp)	{ b(0x66); rex(src, RDI); b(0x89); at_rdi(src, disp); }
+	void store_w_i(int disp, int imm)	{ b(0x66); b(0xC7); at_rdi(0, disp); w(imm); }
+
+	void push(int r)	{ rex(0, r); b(0x50 + (r&7)); }
+	void pop(int r)		{ rex(0, r); b(0x58 + (r&7)); }
+	void ret()			{ b(0xC3); }
+};
+
+
+Jit::Jit(Chip8* c)
+{
+	chip = c;
+	code = (unsigned char*)mmap(NULL, CODE_SIZE, PROT_READ|PROT_WRITE,
+			MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+	if(code==MAP_FAILED) {
+		printf("JIT: no code memory, interpreting\n");
+		code = NULL;
+	}
+	flush();
+	chip->jit = this;
+	chip->jit_watch = watch;
+}
+
+Jit::~Jit()
+{
+	if(chip->jit==this) {
+		chip->jit = NULL;
+		chip->jit_watch = NULL;
+	}
+	if(code!=NULL)
+		munmap(code, CODE_SIZE);
+}
+
+void Jit::flush()
+{
+	code_used = 0;
+	for(int i=0; i<PROG_END; i++)
+		block_at[i] = NOT_COMPILED;
+	memset(watch, 0, sizeof(watch));
+	block_code.clear();
+	block_len.clear();
+}
+
+// a write to compiled code drops everything, self modifying code is rare
+// a write next to an uncompilable instruction may have made it compilable
+void Jit::written(word addr)
+{
+	if(addr>=PROG_END)
+		return;
+	if(watch[addr] & COVERED) {
+		flush();
+		return;
+	}
+	if(block_at[addr]==INTERPRET)
+		block_at[addr] = NOT_COMPILED;
+	if(addr>0 && block_at[addr-1]==INTERPRET)
+		block_at[addr-1] = NOT_COMPILED;
+}
+
+// run up to max_instr instructions, like Chip8::run()
+// a block only runs if it fits in what's left, so counts stay exact
+long long Jit::run(long long max_instr)
+{
+	long long cnt = 0;
+	while(cnt<max_instr) {
+		word pc = chip->PC;
+		if(pc<PROG_START+chip->prog_size) {
+			int b = block_at[pc];
+			if(b==NOT_COMPILED)
+				b = compile(pc);
+			if(b>=0 && block_len[b]<=max_instr-cnt) {
+				block_code[b](chip);
+				cnt += block_len[b];
+				continue;
+			}
+		}
+		cnt++;
+		if(!chip->exec1()) {
+			chip->halted = true;
+			break;
+		}
+	}
+	return cnt;
+}
+
+
+#if defined(__x86_64__)
+
+// registers a compilable instruction touches, false: not compilable
+// bit mask of V registers, bit 16 is IX
+static const int IX_BIT = 1<<16;
+
+static bool uses(Chip8* chip, word op, int& regs)
+{
+	int x = (op>>8)&0xF;
+	int y = (op>>4)&0xF;
+	int vx = 1<<x, vy = 1<<y, vf = 1<<15;
+
+	switch(op>>12) {
+		case 0x6:	regs = vx;				return true;	// SET  Vx, nn
+		case 0x7:	regs = vx|vf;			return true;	// ADD  Vx, nn
+		case 0xA:	regs = IX_BIT;			return true;	// SET  IX, nnn
+		case 0x8:
+			switch(op&0xF) {
+				case 0x0: case 0x1: case 0x2: case 0x3:
+					regs = vx|vy;			return true;
+				case 0x4: case 0x5: case 0x7:
+					regs = vx|vy|vf;		return true;
+				case 0x6: case 0xE:
+					regs = (chip->quirks & QUIRK_SH1VAR) ? vx|vf : vx|vy;
+					return true;
+			}
+			return false;
+		case 0xF:
+			switch(op&0xFF) {
+				case 0x07:	regs = vx;			return true;	// SET  Vx, TIMER
+				case 0x1E:	// ADD  IX, Vx, not with the carry quirk
+					regs = vx|IX_BIT;
+					return (chip->quirks & QUIRK_IXCARRY)==0;
+				case 0x29:	regs = vx|IX_BIT;	return true;	// SET  IX, FONT(Vx)
+			}
+			return false;
+	}
+	return false;
+}
+
+int Jit::compile(word addr)
+{
+	if(code==NULL) {
+		block_at[addr] = INTERPRET;
+		return INTERPRET;
+	}
+
+	// find the block and give every register it uses a host register
+	int host[17];		// V0..VF, IX
+	for(int i=0; i<17; i++)
+		host[i] = NO_REG;
+	int used = 0;
+	int len = 0;
+	// the last word is left to exec1(), PC wraps after it
+	int end = PROG_START + chip->prog_size;
+	if(end>PROG_END-2)
+		end = PROG_END-2;
+	int pc = addr;
+
+	while(len<MAX_LEN && pc<end) {
+		word op = (chip->mem[pc]<<8) | chip->mem[pc+1];
+		int regs;
+		if(!uses(chip, op, regs))
+			break;
+
+		int need = used;
+		for(int i=0; i<17; i++)
+			if((regs & (1<<i)) && host[i]==NO_REG)
+				need++;
+		if(need>pool_size)
+			break;
+		for(int i=0; i<17; i++)
+			if((regs & (1<<i)) && host[i]==NO_REG)
+				host[i] = pool[used++];
+
+		len++;
+		pc += 2;
+	}
+
+	if(len==0) {
+		// a write to either byte can make it compilable
+		block_at[addr] = INTERPRET;
+		watch[addr] |= RETRY;
+		if(addr+1<PROG_END)
+			watch[addr+1] |= RETRY;
+		return INTERPRET;
+	}
+
+	// worst case per instruction is well under 32 bytes
+	if(code_used + len*32 + 256 > CODE_SIZE)
+		flush();
+
+	const int off_V		= (unsigned char*)&chip->V[0] - (unsigned char*)chip;
+	const int off_IX	= (unsigned char*)&chip->IX - (unsigned char*)chip;
+	const int off_PC	= (unsigned char*)&chip->PC - (unsigned char*)chip;
+	const int off_DT	= (unsigned char*)&chip->DT - (unsigned char*)chip;
+
+	mprotect(code, CODE_SIZE, PROT_READ|PROT_WRITE);
+
+	Emit e;
+	e.p = code + code_used;
+	unsigned char* start = e.p;
+
+	for(int i=0; i<17; i++)
+		if(host[i]!=NO_REG && callee_saved(host[i]))
+			e.push(host[i]);
+	for(int i=0; i<16; i++)
+		if(host[i]!=NO_REG)
+			e.load_b(host[i], off_V+i);
+	if(host[16]!=NO_REG)
+		e.load_w(host[16], off_IX);
+
+	// same order of reads and writes as the op_* helpers in Chip8.cpp,
+	// so x==F or y==F come out the same as in the interpreter
+	const int VF = host[15];
+	const int IXR = host[16];
+	for(int i=0; i<len; i++) {
+		word a = addr + i*2;
+		word op = (chip->mem[a]<<8) | chip->mem[a+1];
+		int x = (op>>8)&0xF;
+		int y = (op>>4)&0xF;
+		int nn = op&0xFF;
+		int nnn = op&0xFFF;
+		int Vx = host[x];
+		int Vy = host[y];
+
+		switch(op>>12) {
+			case 0x6:	e.mov_i(Vx, nn);	break;
+
+			case 0x7:	// op_add_reg(x, nn), VF is carry
+				if(x==15)
+					e.mov_i(RAX, nn);
+				else {
+					e.mov(RAX, Vx);
+					e.add_i(RAX, nn);
+				}
+				e.mov(VF, RAX);
+				e.shr(VF, 8);
+				e.movzx_al(Vx);
+				break;
+
+			case 0xA:
+				e.mov_i(IXR, nnn);
+				break;
+
+			case 0x8:
+				switch(op&0xF) {
+					case 0x0:	e.mov(Vx, Vy);	break;
+					case 0x1:	e.or_(Vx, Vy);	break;
+					case 0x2:	e.and_(Vx, Vy);	break;
+					case 0x3:	e.xor_(Vx, Vy);	break;
+
+					case 0x4:	// op_add_reg(x, Vy)
+						if(x==15)
+							e.mov(RAX, Vy);
+						else {
+							e.mov(RAX, Vx);
+							e.add(RAX, Vy);
+						}
+						e.mov(VF, RAX);
+						e.shr(VF, 8);
+						e.movzx_al(Vx);
+						break;
+
+					case 0x5:	// op_sub_reg(x, Vy), VF=1: no borrow
+						e.mov(RAX, Vx);
+						e.add_i(RAX, 0x100);
+						e.sub(RAX, Vy);
+						e.mov(VF, RAX);
+						e.shr(VF, 8);
+						e.movzx_al(Vx);
+						break;
+
+					case 0x7:	// op_rsub_reg(x, Vy)
+						e.mov(RAX, Vy);
+						e.add_i(RAX, 0x100);
+						e.sub(RAX, Vx);
+						e.mov(VF, RAX);
+						e.shr(VF, 8);
+						e.movzx_al(Vx);
+						break;
+
+					case 0x6:	// op_shr_reg
+						if(chip->quirks & QUIRK_SH1VAR) {
+							e.mov(RAX, Vx);
+							e.and_i(RAX, 1);
+							e.mov(VF, RAX);
+							e.shr(Vx, 1);
+						} else {
+							e.mov(RAX, Vy);
+							e.shr(RAX, 1);
+							e.mov(Vx, RAX);
+						}
+						break;
+
+					case 0xE:	// op_shl_reg
+						if(chip->quirks & QUIRK_SH1VAR) {
+							e.mov(RAX, Vx);
+							e.shr(RAX, 7);
+							e.mov(VF, RAX);
+							e.mov(RAX, Vx);
+						} else
+							e.mov(RAX, Vy);
+						e.add(RAX, RAX);
+						e.movzx_al(Vx);
+						break;
+				}
+				break;
+
+			case 0xF:
+				switch(nn) {
+					case 0x07:	e.load_b(Vx, off_DT);	break;
+
+					case 0x1E:
+						e.add(IXR, Vx);
+						e.and_i(IXR, 0xFFFF);
+						break;
+
+					case 0x29:	// FONT_START + Vx*5
+						e.mov(RAX, Vx);
+						e.shl(RAX, 2);
+						e.add(RAX, Vx);
+						e.add_i(RAX, FONT_START);
+						e.mov(IXR, RAX);
+						break;
+				}
+				break;
+		}
+	}
+
+	for(int i=0; i<16; i++)
+		if(host[i]!=NO_REG)
+			e.store_b(host[i], off_V+i);
+	if(host[16]!=NO_REG)
+		e.store_w(host[16], off_IX);
+	e.store_w_i(off_PC, addr + len*2);
+	for(int i=16; i>=0; i--)
+		if(host[i]!=NO_REG && callee_saved(host[i]))
+			e.pop(host[i]);
+	e.ret();
+
+	code_used += e.p - start;
+	mprotect(code, CODE_SIZE, PROT_READ|PROT_EXEC);
+
+	int b = block_code.size();
+	block_code.push_back((block_fn)start);
+	block_len.push_back(len);
+	block_at[addr] = b;
+	for(int i=0; i<len*2 && addr+i<PROG_END; i++)
+		watch[addr+i] |= COVERED;
+	return b;
+}
+
+#else
+
+int Jit::compile(word addr)
+{
+	block_at[addr] = INTERPRET;
+	return INTERPRET;
+}
+
+#endif
@@ -0,0 +1,66 @@
+// Jit.h
+
+#ifndef JIT_H
+#define JIT_H
+
+#include <vector>
+
+#include "Chip8.h"
+
+// x86-64 dynamic recompiler for one Chip8
+//
+// A block is the longest straight run of register-only instructions from an
+// address (SET, ADD, the 8xyp ALU ops, SET/ADD IX, FONT, GET TIMER), compiled
+// to native code with the V registers and IX it uses kept in host registers.
+// Everything else (JMP, CALL, RET, skips, DRAW, WAIT, STO/BCD, RAND, ...) ends
+// the block and runs in the interpreter, Chip8::exec1(), which stays the
+// reference.
+//
+// Writes to memory covered by a block (STO, BCD) throw all compiled code away.
+// Chip8::mem_write() checks watch[] inline and only calls written() for the
+// bytes marked there, a store to data costs no call.
+// On other hosts than x86-64 nothing is compiled and run() is the interpreter.
+//
+// usage:
+//	Jit jit(&chip);		// attach, chip.run() now goes through the JIT
+//	chip.run(n);
+
+class Jit {
+public:
+	Jit(Chip8* chip);
+	~Jit();
+	Jit(const Jit&) = delete;
+	Jit& operator=(const Jit&) = delete;
+
+	long long run(long long max_instr);
+
+	void flush();				// drop all compiled code
+	void written(word addr);	// memory at addr was changed
+
+	int blocks() const { return block_code.size(); }
+
+private:
+	typedef void (*block_fn)(Chip8* chip);
+
+	static const int CODE_SIZE	= 1<<20;	// 1MB of native code, flushed when full
+	static const int MAX_LEN	= 64;		// instructions per block
+	static const int NOT_COMPILED	= -1;
+	static const int INTERPRET	= -2;	// first instruction can't be compiled
+
+	Chip8* chip;
+
+	unsigned char* code;		// mmap'd, RW while compiling, RX while running
+	int code_used;
+
+	static const byte COVERED	= 1;	// watch[]: part of a compiled block
+	static const byte RETRY		= 2;	// an INTERPRET instruction reads it
+
+	int block_at[PROG_END];			// index into block_code/block_len, or the above
+	byte watch[PROG_END];			// a write there goes to written(), 0: doesn't matter
+	std::vector<block_fn> block_code;
+	std::vector<int> block_len;
+
+	int compile(word addr);
+};
+
+#endif
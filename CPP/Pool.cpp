@@ -0,0 +1,63 @@
+// Pool.cpp
+
+#include "Pool.h"
+
+Pool::Pool(int threads) : queues(threads>0 ? threads : (std::thread::hardware_concurrency()>0 ? std::thread::hardware_concurrency() : 1))
+{
+	workers = queues.size();
+	next = 0;
+}
+
+void Pool::add(Job job)
+{
+	Queue& q = queues[next];
+	next = (next+1) % workers;
+
+	std::lock_guard<std::mutex> guard(q.lock);
+	q.jobs.push_back(job);
+}
+
+// own queue, newest first
+bool Pool::pop(int id, Job& job)
+{
+	Queue& q = queues[id];
+	std::lock_guard<std::mutex> guard(q.lock);
+	if(q.jobs.empty())
+		return false;
+	job = q.jobs.back();
+	q.jobs.pop_back();
+	return true;
+}
+
+// someone else's queue, oldest first
+bool Pool::steal(int id, Job& job)
+{
+	for(int i=1; i<workers; i++) {
+		Queue& q = queues[(id+i) % workers];
+		std::lock_guard<std::mutex> guard(q.lock);
+		if(!q.jobs.empty()) {
+			job = q.jobs.front();
+			q.jobs.pop_front();
+			return true;
+		}
+	}
+	return false;
+}
+
+// no jobs are added while running, so once every queue is empty we're done
+void Pool::work(int id)
+{
+	Job job;
+	while(pop(id, job) || steal(id, job))
+		job();
+}
+
+void Pool::run()
+{
+	std::vector<std::thread> threads;
+	for(int i=1; i<workers; i++)
+		threads.push_back(std::thread(&Pool::work, this, i));
+	work(0);	// this thread is worker 0
+	for(std::thread& t : threads)
+		t.join();
+}
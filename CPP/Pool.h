@@ -0,0 +1,42 @@
+// Pool.h
+
+#ifndef POOL_H
+#define POOL_H
+
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Work-stealing thread pool
+// every worker has its own queue, takes work from the back of it, and when
+// it runs dry steals from the front of the others
+// jobs are added before run(), run() blocks until all of them are done
+class Pool {
+public:
+	typedef std::function<void()> Job;
+
+	Pool(int threads);	// 0: one per core
+
+	void add(Job job);	// spread round robin over the workers
+	void run();
+
+	int size() const { return workers; }
+
+private:
+	struct Queue {
+		std::mutex lock;
+		std::deque<Job> jobs;
+	};
+
+	int workers;
+	int next;
+	std::vector<Queue> queues;
+
+	bool pop(int id, Job& job);
+	bool steal(int id, Job& job);
+	void work(int id);
+};
+
+#endif
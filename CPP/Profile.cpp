@@ -0,0 +1,307 @@
+// Profile.cpp
+
+// instruction counting around Chip8::exec1(), see Profile.h
+
+#include <string.h>
+#include <time.h>
+
+#include <algorithm>
+#include <string>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "Profile.h"
+
+static double wall()
+{
+	timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec/1e9;
+}
+
+// host cycles, or ns where there's no cycle counter
+static inline unsigned long long cycles_now()
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec*1000000000ULL + t.tv_nsec;
+#endif
+}
+
+static int log2_bucket(unsigned long long v)
+{
+	int b = 0;
+	while(v>1 && b<31) {
+		v >>= 1;
+		b++;
+	}
+	return b;
+}
+
+Profiler::Profiler(Chip8* c)
+{
+	chip = c;
+
+	instr = 0;
+	cycles = 0;
+	t_start = wall();
+	c_start = cycles_now();
+
+	class_cnt.assign(CLASSES, 0);
+	class_cyc.assign(CLASSES, 0);
+	class_hist.assign(CLASSES*BUCKETS, 0);
+	memset(pc_cnt, 0, sizeof(pc_cnt));
+	memset(pc_cyc, 0, sizeof(pc_cyc));
+
+	draws = 0;
+	draw_rows = 0;
+	collisions = 0;
+
+	nodes.push_back({ -1, chip->PC, 0 });
+	stack.push_back(0);
+	cur = 0;
+
+	chip->prof = this;
+}
+
+Profiler::~Profiler()
+{
+	if(chip->prof==this)
+		chip->prof = NULL;
+}
+
+// group<<8 | sub-op, sub-op is what tells the instructions of a group apart:
+// the low byte for 00pp/Expp/Fxpp, the low nibble for 5xyp/8xyp/9xyp
+int Profiler::op_class(word op)
+{
+	int grp = op>>12;
+	switch(grp) {
+		case 0x0:
+			if(op & 0x0F00)
+				return 0x01;			// 0nnn, machine code call
+			if((op & 0xF0)==0xC0)
+				return 0xC0;			// 00Cn
+			return op & 0xFF;
+		case 0x5:
+		case 0x8:
+		case 0x9:
+			return grp<<8 | (op & 0xF);
+		case 0xE:
+		case 0xF:
+			return grp<<8 | (op & 0xFF);
+	}
+	return grp<<8;
+}
+
+void Profiler::class_name(int cls, char* buf)
+{
+	int grp = cls>>8;
+	int sub = cls & 0xFF;
+	switch(grp) {
+		case 0x0:
+			if(sub==0x01)		strcpy(buf, "0nnn");
+			else if(sub==0xC0)	strcpy(buf, "00Cn");
+			else				sprintf(buf, "00%02X", sub);
+			break;
+		case 0x5:
+		case 0x8:
+		case 0x9:	sprintf(buf, "%Xxy%X", grp, sub);	break;
+		case 0xD:	strcpy(buf, "Dxyn");				break;
+		case 0xE:
+		case 0xF:	sprintf(buf, "%Xx%02X", grp, sub);	break;
+		case 0x1:
+		case 0x2:
+		case 0xA:
+		case 0xB:	sprintf(buf, "%Xnnn", grp);			break;
+		default:	sprintf(buf, "%Xxnn", grp);			break;
+	}
+}
+
+void Profiler::call(word addr)
+{
+	unsigned long long key = (unsigned long long)cur<<16 | addr;
+	auto it = children.find(key);
+	int node;
+	if(it!=children.end())
+		node = it->second;
+	else {
+		node = nodes.size();
+		nodes.push_back({ cur, addr, 0 });
+		children[key] = node;
+	}
+	stack.push_back(node);
+	cur = node;
+}
+
+void Profiler::ret()
+{
+	if(stack.size()>1)
+		stack.pop_back();
+	cur = stack.back();
+}
+
+bool Profiler::step()
+{
+	word pc = chip->PC;
+	word op = pc+1<MEM_SIZE ? (chip->mem[pc]<<8) | chip->mem[pc+1] : 0;
+	word sp = chip->SP;
+
+	unsigned long long c0 = cycles_now();
+	bool ok = chip->exec1();
+	unsigned long long dt = cycles_now() - c0;
+
+	instr++;
+	cycles += dt;
+	int cls = op_class(op);
+	class_cnt[cls]++;
+	class_cyc[cls] += dt;
+	class_hist[cls*BUCKETS + log2_bucket(dt)]++;
+	if(pc<PROG_END) {
+		pc_cnt[pc]++;
+		pc_cyc[pc] += dt;
+	}
+	nodes[cur].instr++;
+
+	switch(op>>12) {
+		case 0x2:
+			if(chip->SP>sp)
+				call(chip->PC);
+			break;
+		case 0x0:
+			if(op==0x00EE && chip->SP<sp)
+				ret();
+			break;
+		case 0xD:
+			draws++;
+			draw_rows += (op & 0xF) ? (op & 0xF) : ((chip->quirks & QUIRK_SPR16) ? 16 : 0);
+			collisions += chip->V[0xF] & 1;
+			break;
+	}
+	return ok;
+}
+
+// same contract as Chip8::run()
+long long Profiler::run(long long max_instr)
+{
+	long long cnt = 0;
+	while(cnt<max_instr) {
+		cnt++;
+		if(!step()) {
+			chip->halted = true;
+			break;
+		}
+	}
+	return cnt;
+}
+
+double Profiler::ns_per_cycle() const
+{
+	unsigned long long c = cycles_now() - c_start;
+	return c>0 ? (wall() - t_start)*1e9/c : 0;
+}
+
+void Profiler::report(FILE* out, int top) const
+{
+	double ns = ns_per_cycle();
+	char name[8];
+
+	fprintf(out, "PROFILE: instructions=%lld cycles=%llu time=%.3fs ns/instr=%.1f\n",
+			instr, cycles, cycles*ns/1e9, instr>0 ? cycles*ns/instr : 0.0);
+	fprintf(out, "DRAW: calls=%lld rows=%lld collisions=%lld (%.1f%%)\n",
+			draws, draw_rows, collisions, draws>0 ? 100.0*collisions/draws : 0.0);
+
+	// opcode classes, most time first
+	std::vector<int> cls;
+	for(int i=0; i<CLASSES; i++)
+		if(class_cnt[i]>0)
+			cls.push_back(i);
+	std::sort(cls.begin(), cls.end(), [this](int a, int b) { return class_cyc[a]>class_cyc[b]; });
+
+	fprintf(out, "\nop\t%12s %6s %14s %6s %8s\n", "count", "%", "cycles", "%", "cyc/op");
+	for(int i : cls) {
+		class_name(i, name);
+		fprintf(out, "%s\t%12lld %6.2f %14llu %6.2f %8.1f\n", name,
+				class_cnt[i], 100.0*class_cnt[i]/instr,
+				class_cyc[i], cycles>0 ? 100.0*class_cyc[i]/cycles : 0.0,
+				(double)class_cyc[i]/class_cnt[i]);
+	}
+
+	// cycles per instruction, bucket b counts 2^b..2^(b+1)-1
+	int hi = 0;
+	for(int i : cls)
+		for(int b=0; b<BUCKETS; b++)
+			if(class_hist[i*BUCKETS + b]>0)
+				hi = std::max(hi, b);
+	fprintf(out, "\ncycles/op\t");
+	for(int b=0; b<=hi; b++)
+		fprintf(out, " %9llu", 1ULL<<b);
+	fprintf(out, "\n");
+	for(int i : cls) {
+		class_name(i, name);
+		fprintf(out, "%s\t\t", name);
+		for(int b=0; b<=hi; b++)
+			fprintf(out, " %9lld", class_hist[i*BUCKETS + b]);
+		fprintf(out, "\n");
+	}
+
+	// hot addresses
+	std::vector<int> pcs;
+	for(int pc=0; pc<PROG_END; pc++)
+		if(pc_cnt[pc]>0)
+			pcs.push_back(pc);
+	std::sort(pcs.begin(), pcs.end(), [this](int a, int b) { return pc_cyc[a]>pc_cyc[b]; });
+	if((int)pcs.size()>top)
+		pcs.resize(top);
+
+	fprintf(out, "\naddr\top\t%12s %6s %14s %6s %8s\n", "count", "%", "cycles", "%", "cyc/op");
+	for(int pc : pcs) {
+		fprintf(out, "%04X\t%02X%02X\t%12lld %6.2f %14llu %6.2f %8.1f\n", pc,
+				chip->mem[pc], chip->mem[pc+1],
+				pc_cnt[pc], 100.0*pc_cnt[pc]/instr,
+				pc_cyc[pc], cycles>0 ? 100.0*pc_cyc[pc]/cycles : 0.0,
+				(double)pc_cyc[pc]/pc_cnt[pc]);
+	}
+}
+
+void Profiler::folded(FILE* out) const
+{
+	for(int i=0; i<(int)nodes.size(); i++) {
+		if(nodes[i].instr==0)
+			continue;
+		std::string frames;
+		for(int n=i; n>0; n=nodes[n].parent) {
+			char buf[16];
+			sprintf(buf, ";sub_%03X", nodes[n].addr);
+			frames.insert(0, buf);
+		}
+		fprintf(out, "main%s %lld\n", frames.c_str(), nodes[i].instr);
+	}
+}
+
+bool Profiler::save(const char* prefix) const
+{
+	std::string txt = std::string(prefix) + ".txt";
+	std::string fold = std::string(prefix) + ".folded";
+
+	FILE* f = fopen(txt.c_str(), "w");
+	if(f==NULL) {
+		printf("Can't write %s\n", txt.c_str());
+		return false;
+	}
+	report(f);
+	fclose(f);
+
+	f = fopen(fold.c_str(), "w");
+	if(f==NULL) {
+		printf("Can't write %s\n", fold.c_str());
+		return false;
+	}
+	folded(f);
+	fclose(f);
+	return true;
+}
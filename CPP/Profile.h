@@ -0,0 +1,85 @@
+// Profile.h
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdio.h>
+
+#include <unordered_map>
+#include <vector>
+
+#include "Chip8.h"
+
+// Execution profiler for one Chip8
+//
+// Counts every instruction per opcode class (8xy4, Fx33, ...) and per guest
+// address, with host cycles per instruction (rdtsc, ns on other hosts) summed
+// and bucketed by log2, DRAW calls, rows and collisions, and the guest call
+// stack (CALL/RET) for a folded stack file, one line per stack:
+//	main;sub_2A4;sub_310 12345
+// weighted by instructions, flamegraph.pl reads it as is.
+//
+// While attached the machine runs through the interpreter, the JIT is left out.
+// Detached, the only cost is the NULL check in Chip8::run().
+//
+// usage:
+//	Profiler prof(&chip);		// attach, chip.run() now goes through here
+//	chip.run(n);				// or prof.step() instead of chip.exec1()
+//	prof.report(stdout);
+//	prof.folded(file);
+
+class Profiler {
+public:
+	Profiler(Chip8* chip);
+	~Profiler();
+	Profiler(const Profiler&) = delete;
+	Profiler& operator=(const Profiler&) = delete;
+
+	bool step();					// Chip8::exec1(), counted
+	long long run(long long max_instr);
+
+	void report(FILE* out, int top=40) const;
+	void folded(FILE* out) const;
+	bool save(const char* prefix) const;	// prefix.txt and prefix.folded
+
+private:
+	static const int CLASSES	= 16<<8;	// group<<8 | sub-op, see op_class()
+	static const int BUCKETS	= 32;		// log2 cycles per instruction
+
+	struct Node {					// one guest call stack
+		int parent;
+		word addr;					// called address
+		long long instr;			// executed with exactly this stack
+	};
+
+	Chip8* chip;
+
+	long long instr;
+	unsigned long long cycles;
+	double t_start;					// wall clock and cycles at attach,
+	unsigned long long c_start;		// for cycles -> ns
+
+	std::vector<long long> class_cnt;
+	std::vector<unsigned long long> class_cyc;
+	std::vector<long long> class_hist;		// CLASSES x BUCKETS
+
+	long long pc_cnt[PROG_END];
+	unsigned long long pc_cyc[PROG_END];
+
+	long long draws;
+	long long draw_rows;
+	long long collisions;
+
+	std::vector<Node> nodes;
+	std::unordered_map<unsigned long long, int> children;	// parent<<16 | addr -> node, 64 bit: more than 64K nodes
+	std::vector<int> stack;			// nodes, [0] is main
+	int cur;
+
+	static int op_class(word op);
+	static void class_name(int cls, char* buf);
+	void call(word addr);
+	void ret();
+	double ns_per_cycle() const;
+};
+
+#endif
@@ -1,127 +1,452 @@
 // main.cpp
 
+#include <GL/freeglut.h>
 #include <GL/glut.h>  // GLUT, include glu.h and gl.h
+#include <math.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
 
-#include "Screen.cpp"
-#include "Chip8.cpp"
+#include "Chip8.h"
+#include "Audio.h"
+#include "Display.h"
+#include "Input.h"
+#include "Jit.h"
+#include "Profile.h"
+#include "Rewind.h"
+#include "Sound.h"
+#include "Tracer.h"
+#include "Trace.h"
 
 #define ROM "roms/test_opcode.ch8"
 // #define ROM "roms/PONG.bin"
 // #define ROM "roms/TETRIS.bin"
 // #define ROM "roms/BC_test.ch8"
 
+// command line settings
+char* rom_file = (char*)ROM;
+bool headless = false;			// -H: no window, no sound, no timers, just run
+long long max_instr = 0;		// -n: instruction budget, 0=no limit
+long long max_frames = 0;		// -f: frame budget (60/sec), 0=no limit
+int instr_per_frame = 16;		// -i: instructions per 60Hz frame
+int exit_addr = -1;				// -x: stop when PC reaches this address
+bool exit_idle = false;			// -l: stop when an instruction loops on itself (JMP self, WAIT key)
+bool use_jit = false;			// -J: recompile register-only blocks to x86-64
+const char* profile_out = NULL;	// -P: profile to <prefix>.txt and <prefix>.folded
+Profiler* profiler = NULL;
+const char* trace_out = NULL;	// -t: binary trace of every instruction
+Tracer* tracer = NULL;
+char* state_in = NULL;			// -R: boot from this save state instead of the ROM
+char* state_out = NULL;			// -S: write a save state here when the run stops
+long long seed = -1;			// -s: RAND seed, -1: from the clock
+int quirks = QUIRKS_AUTO;		// -q: quirk profile or mask, default picked from the ROM
+char* record_file = NULL;		// -r: record key input (and seed) to this file
+char* play_file = NULL;			// -p: play key input back from a -r file
+int rewind_mb = 0;				// -w: MB of rewind history, hold backspace to go back, 0=off
+char* audio_out = NULL;			// -a: "null" or a .wav file, default OpenAL with a window, none headless
 
-// int loop_num = 0;
-// int loop_cnt = 0;
+// the machine shown in the window, GLUT callbacks can't carry a pointer
+Chip8 chip;
+Audio* audio = NULL;
+Rewind* rewind_buf = NULL;
+bool rewinding = false;			// backspace held
+InputLog input_log;				// -r or -p
+long long frame_no = 0;			// frames run so far, input is timed by this
+
+
+// 60Hz timers, and a frame of emulated time for the audio
+void tick()
+{
+	chip.timers_tick();
+	if(audio!=NULL)
+		audio->frame();
+}
+
+// present the screen once per frame (60Hz), only the rows that changed
+// XOR erase/redraw pairs within a frame never reach the window
 void frame()
 {
-// 	loop_num++;
-// 	if(loop_num>=scr_buf_size)
-// 	{
-// 		loop_num=0;
-// 		loop_cnt++;
-// 		printf("%d ", loop_cnt);
-// 	}
-// 	scr_buffer[loop_num] = SCREEN_PIXEL;
-
-// 	if (chip_exec1()==false)
-// 		exit(exit_code);
-// 	else
-//  		glutPostRedisplay();
-		// should only do it if scr-buffer has changed
-		// the way to do that is to only let screen handle buffer
-		// putting pixels etc, make a function, and it'll do the post
-		// chip doesn't have to, or loop here doesn't either
-
-	// add soem global variable, refresh_scr, or something, bool
-	// set to true whenever a draw function is called in the chip
-
-	if(scr_refresh)
-	{
-		glutPostRedisplay();
-		scr_refresh = false;
-	}
+	unsigned long long dirty = chip.screen.take_dirty();
+	if(dirty!=0)
+		scr_update(dirty);
 }
 
 
+// frame scheduler
+// one GLUT timer callback per frame: run instr_per_frame instructions, tick
+// DT/ST once, present. Frame deadlines are absolute on the monotonic clock,
+// so a late callback is made up by the next one instead of adding up.
+const double FRAME_TIME = 1.0/60.0;
+const int FRAME_CATCH_UP = 4;		// frames run back to back after a stall, then give up
 
-void timer(int id)
+double next_frame;					// deadline of the next frame, seconds
+
+double now()
 {
-// 	printf("***\n");
-//	printf("\a");
+	timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec/1e9;
+}
+
+void timer(int id);
+
+void schedule_frame()
+{
+	// GLUT timers are in whole ms, round up: late is made up, early is a
+	// wasted wakeup
+	int ms = (int)ceil((next_frame - now())*1000.0);
+	if(ms<0)
+		ms = 0;
+	glutTimerFunc(ms, timer, 0);
+}
 
-	// timer id:1 = cpu cycle tick (1000/sec)
-	if(id==1) {
-		printf("!");
-		if (chip_exec1()==false) {
-// 			exit(exit_code);
-			 glutLeaveMainLoop(); // freeglut extension
+void timer(int id)
+{
+	double t = now();
+	int cnt = 0;
+	while(t>=next_frame) {
+		if(++cnt>FRAME_CATCH_UP) {
+			// too far behind (debugger, suspend), start over from now
+			next_frame = t + FRAME_TIME;
+			break;
+		}
+		if(rewinding) {
+			// a frame back instead of forward, sound is left alone
+			if(rewind_buf->back(chip) && frame_no>0)
+				frame_no--;
+			next_frame += FRAME_TIME;
+			continue;
 		}
-		glutTimerFunc(1, timer, 1);				// CPU clock, 1 ms
-	} else if(id==2) {
-		// timer id 2: delay timer
-		printf("*");
-		chip_timers_tick();
-// 		// should fix so it only restarts timer when DT>0
-//  		glutTimerFunc(1000.0/60.0, timer, 2);	// 60/sec timers
-		start_delay_timer();
+		if(play_file!=NULL)
+			input_log.play(frame_no, chip);
+		TRACE_FULL("!");
+		chip.run(instr_per_frame);
+		if(chip.halted) {
+			glutLeaveMainLoop(); // freeglut extension
+			return;
+		}
+		TRACE_FULL("*");
+		tick();
+		frame_no++;
+		if(rewind_buf!=NULL)
+			rewind_buf->push(chip);
+		next_frame += FRAME_TIME;
 	}
+	if(cnt>0)
+		frame();
+	schedule_frame();
+}
 
-// 	glutPostRedisplay();
-// 	glutTimerFunc(1000.0/60.0, timer, 0);
+// machine hooks, only set when there's audio
+// the audio thread counts the beep down itself, no ST tick hook needed
+// a pitch change goes out right away, a beep that's on changes with it
+void on_sound_pitch(Chip8* c)
+{
+	if(c->pattern_on)
+		audio->pattern(c->pattern, c->rate);
+	else
+		audio->pitch(c->pitch);
 }
 
-void start_delay_timer()
+void on_sound_start(Chip8* c, float dur)
 {
-	// only restart when DT is set>0
-	glutTimerFunc(1000.0/60.0, timer, 2);	// 60/sec timers
+	on_sound_pitch(c);
+	audio->tone(c->ST);
 }
 
 
+const unsigned char KEY_REWIND = 8;	// backspace
+
 void key_input(unsigned char key, int x, int y)
 {
-	KEY = key;
-	printf("KEY PRESSED:'%c' %02X\n", KEY, key);
+	if(key==KEY_REWIND && rewind_buf!=NULL) {
+		rewinding = true;
+		return;
+	}
+	chip.KEY = key;
+	if(record_file!=NULL)
+		input_log.record(frame_no, key);
+	TRACE_FULL("KEY PRESSED:'%c' %02X\n", chip.KEY, key);
 }
 
 void key_release(unsigned char key, int x, int y)
 {
-	KEY = 0x00;
-	printf("KEY RELEASED:'%c' %02X\n", KEY, KEY);
+	if(key==KEY_REWIND && rewind_buf!=NULL) {
+		rewinding = false;
+		return;
+	}
+	chip.KEY = 0x00;
+	if(record_file!=NULL)
+		input_log.record(frame_no, 0x00);
+	TRACE_FULL("KEY RELEASED:'%c' %02X\n", chip.KEY, chip.KEY);
+}
+
+
+double elapsed(timespec* t0, timespec* t1)
+{
+	return (t1->tv_sec - t0->tv_sec) + (t1->tv_nsec - t0->tv_nsec)/1e9;
+}
+
+// Chip8::exec1(), or through whatever watches it
+bool step1()
+{
+	if(profiler!=NULL)
+		return profiler->step();
+	if(tracer!=NULL)
+		return tracer->step();
+	return chip.exec1();
 }
 
+// one instruction at a time, for the stop conditions that need to see every PC
+const char* run_stepped(long long& instr, long long& frames)
+{
+	int frame_cnt = 0;
+	while(true) {
+		if(max_instr>0 && instr>=max_instr)
+			break;
+		if(max_frames>0 && frames>=max_frames)
+			break;
+		if(chip.PC==exit_addr)
+			return "exit address";
+
+		if(frame_cnt==0 && play_file!=NULL)
+			input_log.play(frames, chip);
+		word pc = chip.PC;
+		instr++;
+		if(step1()==false)
+			return "halt";
+		if(exit_idle && chip.PC==pc)
+			return "idle loop";
+
+		if(++frame_cnt>=instr_per_frame) {
+			frame_cnt = 0;
+			frames++;
+			tick();
+		}
+	}
+	return "budget";
+}
+
+// a frame at a time through Chip8::run(), so the JIT gets whole blocks
+const char* run_frames(long long& instr, long long& frames)
+{
+	while(true) {
+		if(max_frames>0 && frames>=max_frames)
+			break;
+		long long n = instr_per_frame;
+		if(max_instr>0) {
+			if(instr>=max_instr)
+				break;
+			if(max_instr-instr<n)
+				n = max_instr-instr;
+		}
+		if(play_file!=NULL)
+			input_log.play(frames, chip);
+		instr += chip.run(n);
+		if(chip.halted)
+			return "halt";
+		if(n==instr_per_frame) {
+			frames++;
+			tick();
+		}
+	}
+	return "budget";
+}
+
+// run as fast as possible, no GLUT, no OpenAL, no 1 ms clock
+// timers are ticked every instr_per_frame instructions, so a "frame" is
+// emulated time, not wall time
+void run_headless()
+{
+	long long instr = 0;
+	long long frames = 0;
+	const char* reason;
+	timespec t0, t1;
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	if(exit_addr>=0 || exit_idle)
+		reason = run_stepped(instr, frames);
+	else
+		reason = run_frames(instr, frames);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+
+	double sec = elapsed(&t0, &t1);
+	fprintf(stderr, "HEADLESS: stop=%s PC=%04X exit=%d instructions=%lld frames=%lld time=%.3fs IPS=%.0f\n",
+			reason, chip.PC, chip.exit_code, instr, frames, sec, sec>0 ? instr/sec : 0.0);
+}
+
+void usage(const char* name)
+{
+	printf("usage: %s [-H] [-n instr] [-f frames] [-i instr/frame] [-x addr] [-l] [-J] [-P prefix] [-t trace] [-s seed] [-q quirks] [-r input] [-p input] [-w mb] [-R state] [-S state] [-a out] [rom]\n", name);
+	printf("\t-H\theadless, no window or sound, run unthrottled\n");
+	printf("\t-n\tstop after n instructions\n");
+	printf("\t-f\tstop after n frames (60Hz timer ticks)\n");
+	printf("\t-i\tinstructions per frame (default %d)\n", instr_per_frame);
+	printf("\t-x\tstop when PC reaches addr (hex)\n");
+	printf("\t-l\tstop when an instruction loops on itself\n");
+	printf("\t-J\tcompile to native code (x86-64)\n");
+	printf("\t-P\tprofile, report to prefix.txt, call stacks to prefix.folded (no -J)\n");
+	printf("\t-t\tbinary trace of every instruction to a file, TraceDump reads it (no -J)\n");
+	printf("\t-s\tRAND seed (default from the clock)\n");
+	printf("\t-q\tquirks: vip chip48 schip xochip default, or a QUIRK_* mask (default: from the opcodes in the ROM)\n");
+	printf("\t-r\trecord key input to a file\n");
+	printf("\t-p\tplay key input back from a -r file, with its seed and -i\n");
+	printf("\t-w\tkeep mb MB of rewind history, hold backspace to go back\n");
+	printf("\t-R\tstart from a save state (Program -S) instead of a ROM\n");
+	printf("\t-S\tsave the machine state to a file at the end\n");
+	printf("\t-a\taudio out: null or a .wav file (default: sound card, none with -H)\n");
+}
 
 void cli_arguments(int argc, char** argv)
 {
 	// argumnents:
 	// <file>		- binary file to run, default load to 0x200
+	for(int i=1; i<argc; i++) {
+		char* arg = argv[i];
+		bool has_val = i+1<argc;
 
+		if(strcmp(arg, "-H")==0)
+			headless = true;
+		else if(strcmp(arg, "-l")==0)
+			exit_idle = true;
+		else if(strcmp(arg, "-J")==0)
+			use_jit = true;
+		else if(strcmp(arg, "-n")==0 && has_val)
+			max_instr = atoll(argv[++i]);
+		else if(strcmp(arg, "-f")==0 && has_val)
+			max_frames = atoll(argv[++i]);
+		else if(strcmp(arg, "-i")==0 && has_val)
+			instr_per_frame = atoi(argv[++i]);
+		else if(strcmp(arg, "-s")==0 && has_val)
+			seed = strtoul(argv[++i], NULL, 0);
+		else if(strcmp(arg, "-q")==0 && has_val) {
+			quirks = quirks_parse(argv[++i]);
+			if(quirks==-2) {
+				usage(argv[0]);
+				exit(1);
+			}
+		} else if(strcmp(arg, "-P")==0 && has_val)
+			profile_out = argv[++i];
+		else if(strcmp(arg, "-t")==0 && has_val)
+			trace_out = argv[++i];
+		else if(strcmp(arg, "-r")==0 && has_val)
+			record_file = argv[++i];
+		else if(strcmp(arg, "-p")==0 && has_val)
+			play_file = argv[++i];
+		else if(strcmp(arg, "-w")==0 && has_val)
+			rewind_mb = atoi(argv[++i]);
+		else if(strcmp(arg, "-R")==0 && has_val)
+			state_in = argv[++i];
+		else if(strcmp(arg, "-S")==0 && has_val)
+			state_out = argv[++i];
+		else if(strcmp(arg, "-a")==0 && has_val)
+			audio_out = argv[++i];
+		else if(strcmp(arg, "-x")==0 && has_val)
+			exit_addr = strtol(argv[++i], NULL, 16);
+		else if(arg[0]=='-') {
+			usage(argv[0]);
+			exit(1);
+		} else
+			rom_file = arg;
+	}
+	if(instr_per_frame<1)
+		instr_per_frame = 1;
 }
 
 int main(int argc, char** argv)
 {
-	char* file_name = (char*)ROM;
-
 	cli_arguments(argc, argv);
 
-	chip_init();
-	if(chip_load_file(file_name)) {
-		chip_dump_mem();
-		scr_start(argc, argv); // , loop, timer);
+	chip.set_quirks(quirks);	// a save state brings its own
+	if(state_in!=NULL) {
+		if(!chip.load_state_file(state_in))
+			return 1;
+	} else if(!chip.load_file(rom_file))
+		return 1;
+
+	// a recording fixes the seed and clock of the run, so it plays back the same
+	if(play_file!=NULL) {
+		if(!input_log.load(play_file))
+			return 1;
+		chip.seed(input_log.seed);
+		instr_per_frame = input_log.instr_per_frame;
+	} else if(seed>=0 || record_file!=NULL) {
+		if(seed<0)
+			seed = (unsigned int)time(NULL);
+		chip.seed(seed);
+		input_log.seed = seed;
+		input_log.instr_per_frame = instr_per_frame;
+	}
+
+	Jit* jit = NULL;
+	if(use_jit)
+		jit = new Jit(&chip);
+	if(profile_out!=NULL)
+		profiler = new Profiler(&chip);
+	if(trace_out!=NULL) {
+		tracer = new Tracer(&chip, trace_out);
+		if(!tracer->ok())
+			return 1;
+	}
 
-		glutIdleFunc(frame); 					// display update, redraw and flush
-		glutTimerFunc(1, timer, 1);				// CPU clock, 1 ms
-// 		glutTimerFunc(1000.0/60.0, timer, 2);	// 60/sec timers
+	// audio sink, the sound card only with a window
+	AudioSink* sink = NULL;
+	bool sound_card = false;
+	if(audio_out!=NULL && strcmp(audio_out, "null")==0)
+		sink = new NullSink();
+	else if(audio_out!=NULL) {
+		WavSink* wav = new WavSink(audio_out);
+		if(!wav->ok())
+			return 1;
+		sink = wav;
+	} else if(!headless) {
+		sink = sound_init();
+		sound_card = sink!=NULL;
+	}
+	if(sink!=NULL) {
+		audio = new Audio(sink);
+		chip.sound_start_cb = on_sound_start;
+		chip.sound_pitch_cb = on_sound_pitch;
+	}
+
+	if(headless)
+		run_headless();
+	else {
+		if(rewind_mb>0) {
+			rewind_buf = new Rewind((size_t)rewind_mb<<20);
+			rewind_buf->push(chip);
+		}
+		chip.dump_mem();
+		scr_start(argc, argv, &chip.screen); // , loop, timer);
+
+		next_frame = now() + FRAME_TIME;
+		schedule_frame();						// CPU, timers and display, 60/sec
 		glutKeyboardFunc(key_input);
 		glutKeyboardUpFunc(key_release);
 
-		scr_refresh =true;
-
+		// freeglut's default is exit() on window close and on
+		// glutLeaveMainLoop(), the files below and the exit code need it
+		// to come back here
+		glutSetOption(GLUT_ACTION_ON_WINDOW_CLOSE, GLUT_ACTION_GLUTMAINLOOP_RETURNS);
 		glutMainLoop();           				// Enter the event-processing loop
-
 	}
 
-	sound_exit();
-	return exit_code;
+	if(state_out!=NULL)
+		chip.save_state_file(state_out);
+	if(record_file!=NULL)
+		input_log.save(record_file);
+	if(profiler!=NULL)
+		profiler->save(profile_out);
+
+	delete rewind_buf;
+	delete audio;
+	if(sound_card)
+		sound_exit(sink);
+	else
+		delete sink;
+	delete tracer;
+	delete profiler;
+	delete jit;
+	return chip.exit_code;
 }
@@ -0,0 +1,154 @@
+// Rewind.cpp
+
+#include "Rewind.h"
+
+// delta coding: the XOR of a state against its keyframe (same size), as
+// (zero run, literal count, literal bytes) triples, counts as varints
+
+static void put_varint(std::vector<byte>& out, size_t v)
+{
+	while(v>=0x80) {
+		out.push_back((v & 0x7F) | 0x80);
+		v >>= 7;
+	}
+	out.push_back(v);
+}
+
+static size_t get_varint(const byte*& p)
+{
+	size_t v = 0;
+	int shift = 0;
+	while(*p & 0x80) {
+		v |= (size_t)(*p++ & 0x7F) << shift;
+		shift += 7;
+	}
+	v |= (size_t)(*p++) << shift;
+	return v;
+}
+
+static void delta_encode(const std::vector<byte>& key, const std::vector<byte>& cur, std::vector<byte>& out)
+{
+	out.clear();
+	size_t n = cur.size();
+	size_t i = 0;
+	while(i<n) {
+		size_t zeros = 0;
+		while(i<n && key[i]==cur[i]) {
+			zeros++;
+			i++;
+		}
+		// a literal run ends at 4 equal bytes in a row, shorter gaps are
+		// cheaper to keep in the literal
+		size_t lit = i;
+		size_t same = 0;
+		while(lit<n && same<4) {
+			same = key[lit]==cur[lit] ? same+1 : 0;
+			lit++;
+		}
+		if(same>0)
+			lit -= same;
+
+		put_varint(out, zeros);
+		put_varint(out, lit-i);
+		for(; i<lit; i++)
+			out.push_back(key[i]^cur[i]);
+	}
+}
+
+static void delta_decode(const std::vector<byte>& key, const std::vector<byte>& delta, std::vector<byte>& out)
+{
+	out = key;
+	const byte* p = delta.data();
+	const byte* end = p + delta.size();
+	size_t i = 0;
+	while(p<end) {
+		i += get_varint(p);
+		size_t lit = get_varint(p);
+		for(size_t j=0; j<lit; j++)
+			out[i++] ^= *p++;
+	}
+}
+
+
+Rewind::Rewind(size_t max, int every)
+{
+	max_bytes = max;
+	keyframe_every = every>0 ? every : 1;
+	clear();
+}
+
+void Rewind::clear()
+{
+	entries.clear();
+	used = 0;
+	since_key = 0;
+	need_key = true;
+}
+
+// the keyframe an entry is coded against, the nearest one at or before it
+const Rewind::Entry* Rewind::key_of(int index) const
+{
+	for(int i=index; i>=0; i--)
+		if(entries[i].key)
+			return &entries[i];
+	return NULL;
+}
+
+void Rewind::push(const Chip8& chip)
+{
+	chip.save_state(state);
+
+	Entry e;
+	const Entry* key = need_key ? NULL : key_of(entries.size()-1);
+	if(key==NULL || since_key>=keyframe_every || key->data.size()!=state.size()) {
+		// a page of memory turning non-zero changes the layout, start over
+		e.key = true;
+		e.data = state;
+		since_key = 0;
+		need_key = false;
+	} else {
+		e.key = false;
+		delta_encode(key->data, state, e.data);
+		e.data.shrink_to_fit();
+		since_key++;
+	}
+	used += e.data.size();
+	entries.push_back(std::move(e));
+
+	while(used>max_bytes && entries.size()>1)
+		drop_oldest();
+}
+
+// a keyframe and everything coded against it
+void Rewind::drop_oldest()
+{
+	do {
+		used -= entries.front().data.size();
+		entries.pop_front();
+	} while(!entries.empty() && !entries.front().key);
+	if(entries.empty())
+		need_key = true;
+}
+
+bool Rewind::back(Chip8& chip)
+{
+	if(entries.size()<2)
+		return false;
+
+	used -= entries.back().data.size();
+	entries.pop_back();
+
+	// since_key only steers when the next keyframe comes, recount it
+	int i = entries.size()-1;
+	since_key = 0;
+	while(i>0 && !entries[i].key) {
+		since_key++;
+		i--;
+	}
+
+	const Entry& e = entries.back();
+	if(e.key)
+		return chip.load_state(e.data.data(), e.data.size());
+	delta_decode(key_of(entries.size()-1)->data, e.data, decoded);
+	return chip.load_state(decoded.data(), decoded.size());
+}
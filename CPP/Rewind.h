@@ -0,0 +1,51 @@
+// Rewind.h
+
+#ifndef REWIND_H
+#define REWIND_H
+
+#include <deque>
+#include <vector>
+
+#include "Chip8.h"
+
+// History of save states, one per frame, to step a machine back in time
+// Every keyframe_every frames a full state is kept, the frames in between
+// only as the XOR against their keyframe, run length coded (mostly zeros).
+// When the history gets over max_bytes the oldest keyframe and its frames go.
+//
+// usage:
+//	Rewind rewind(8<<20);
+//	rewind.push(chip);			// after every frame
+//	rewind.back(chip);			// machine is now one frame earlier
+class Rewind {
+public:
+	Rewind(size_t max_bytes, int keyframe_every = 60);
+
+	void push(const Chip8& chip);
+	bool back(Chip8& chip);		// false: no older frame left
+	void clear();
+
+	int frames() const { return entries.size(); }
+	size_t bytes() const { return used; }
+
+private:
+	struct Entry {
+		bool key;
+		std::vector<byte> data;		// key: save state, else XOR/RLE against the keyframe
+	};
+
+	size_t max_bytes;
+	int keyframe_every;
+	size_t used;
+	int since_key;					// frames pushed since the last keyframe
+	bool need_key;
+
+	std::deque<Entry> entries;
+	std::vector<byte> state;		// scratch
+	std::vector<byte> decoded;
+
+	const Entry* key_of(int index) const;
+	void drop_oldest();
+};
+
+#endif
@@ -0,0 +1,44 @@
+// Ring.h
+
+#ifndef RING_H
+#define RING_H
+
+#include <atomic>
+
+// Single producer, single consumer queue, no locks
+// one thread only pushes, one thread only pops, N is a power of two
+// head and tail count up forever, the index is the low bits
+template<class T, unsigned N>
+class Ring {
+public:
+	Ring() : head(0), tail(0) {}
+
+	// producer, false: full
+	bool push(const T& item) {
+		unsigned h = head.load(std::memory_order_relaxed);
+		if(h - tail.load(std::memory_order_acquire) == N)
+			return false;
+		items[h & (N-1)] = item;
+		head.store(h+1, std::memory_order_release);
+		return true;
+	}
+
+	// consumer, false: empty
+	bool pop(T& item) {
+		unsigned t = tail.load(std::memory_order_relaxed);
+		if(t == head.load(std::memory_order_acquire))
+			return false;
+		item = items[t & (N-1)];
+		tail.store(t+1, std::memory_order_release);
+		return true;
+	}
+
+private:
+	static_assert((N & (N-1))==0, "Ring size must be a power of two");
+
+	T items[N];
+	alignas(64) std::atomic<unsigned> head;		// next push, written by the producer
+	alignas(64) std::atomic<unsigned> tail;		// next pop, written by the consumer
+};
+
+#endif
@@ -1,137 +1,95 @@
 // screen.cpp
 
-#include <stdio.h>
-// #include <stdlib.h>
-#include <GL/freeglut.h>
-#include <GL/glut.h>  // GLUT, include glu.h and gl.h
+#include <string.h>
 
-// #include "Screen.h"
-
-// trouble converting the functions to a class, static or otherwise
-// because of the function pointers
-
-unsigned short int scr_width;
-unsigned short int scr_height;
-unsigned short int scr_buf_size;
-const unsigned char SCREEN_PIXEL = 0xFF;
-unsigned char* scr_buffer;
-
-// origin at the center of the screen
-// also, range is -1..1 for x and y
-float scr_x_factor;
-float scr_y_factor;
-
-float scr_pixel_red;
-float scr_pixel_green;
-float scr_pixel_blue;
-
-bool scr_refresh = false;
+#include "Screen.h"
 
+Screen::Screen() {
+	rows = new scr_row[SCREEN_PLANES*SCREEN_HIRES_H];
+	init();
+}
 
-void scr_display() {
-	// Clear the color scr_buffer (background)
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+Screen::~Screen() {
+	delete[] rows;
+}
 
-	// quads are probably a bit too slow.
-	// if I use a premade asset instead, might be faster
-	glBegin(GL_QUADS); // 4 vertices form a quad
-	glColor3f(scr_pixel_red, scr_pixel_green, scr_pixel_blue);
+void Screen::init() {
+	planes = 1;
+	set_hires(false);
+}
 
-	for(int i=0; i<scr_buf_size; i++)
-		if(scr_buffer[i]!=0)
-		{
-			int x = i%scr_width-scr_width/2; // -32..31
-			int y = i/scr_width-scr_height/2; // -16..15
+void Screen::set_hires(bool on) {
+	width = on ? SCREEN_HIRES_W : SCREEN_LORES_W;
+	height = on ? SCREEN_HIRES_H : SCREEN_LORES_H;
+	row_mask = ~(scr_row)0 << (SCREEN_ROW_BITS-width);
+	memset(rows, 0, SCREEN_PLANES*SCREEN_HIRES_H*sizeof(scr_row));
+	dirty = ~0ULL >> (64-height);
+}
 
-			float glX = x*scr_x_factor;
-			float glY = y*scr_y_factor;
+void Screen::scroll_up(int n) {
+	if(n>height)
+		n = height;
+	for(int p=0; p<SCREEN_PLANES; p++)
+		if(planes & 1<<p) {
+			scr_row* r = plane(p);
+			memmove(r, r+n, (height-n)*sizeof(scr_row));
+			memset(r+height-n, 0, n*sizeof(scr_row));
+		}
+	dirty = ~0ULL >> (64-height);
+}
 
-			glVertex2f(glX, 				glY);
-			glVertex2f(glX+scr_x_factor,	glY);
-			glVertex2f(glX+scr_x_factor,	glY+scr_y_factor);
-			glVertex2f(glX,					glY+scr_y_factor);
+void Screen::scroll_down(int n) {
+	if(n>height)
+		n = height;
+	for(int p=0; p<SCREEN_PLANES; p++)
+		if(planes & 1<<p) {
+			scr_row* r = plane(p);
+			memmove(r+n, r, (height-n)*sizeof(scr_row));
+			memset(r, 0, n*sizeof(scr_row));
 		}
-	glEnd();
-	//    	glFlush();  // Render now
-	glutSwapBuffers();		// double scr_buffering swap
+	dirty = ~0ULL >> (64-height);
 }
 
+// nothing is kept right of the width, so no mask needed going left
+void Screen::scroll_left(int n) {
+	for(int p=0; p<SCREEN_PLANES; p++)
+		if(planes & 1<<p) {
+			scr_row* r = plane(p);
+			for(int y=0; y<height; y++)
+				r[y] <<= n;
+		}
+	dirty = ~0ULL >> (64-height);
+}
 
-// void scr_idle() {
-// 	glutPostRedisplay();
-// }
+void Screen::scroll_right(int n) {
+	for(int p=0; p<SCREEN_PLANES; p++)
+		if(planes & 1<<p) {
+			scr_row* r = plane(p);
+			for(int y=0; y<height; y++)
+				r[y] = (r[y] >> n) & row_mask;
+		}
+	dirty = ~0ULL >> (64-height);
+}
 
-void scr_clear() {
-	for(int i=0; i<scr_buf_size; i++)
-		scr_buffer[i] = 0;
-	glutPostRedisplay();
+void Screen::clear() {
+	for(int p=0; p<SCREEN_PLANES; p++)
+		if(planes & 1<<p)
+			memset(plane(p), 0, height*sizeof(scr_row));
+	// host does the redisplay, so it also works without a window (headless)
+	dirty = ~0ULL >> (64-height);
 }
 
-// return true if collision
-bool scr_xor_pixel(int x, int y) {
-	int pos = x+y*scr_width;
-	bool ret = false; // no collision
-	if(scr_buffer[pos]!=0) {
-		ret = true;
-		scr_buffer[pos] = 0;
-	} else {
-		scr_buffer[x+y*scr_width] = SCREEN_PIXEL;
+void Screen::unpack_row(int y, unsigned char* out) const {
+	scr_row r0 = plane(0)[y];
+	scr_row r1 = plane(1)[y];
+	for(int x=0; x<width; x++) {
+		*out++ = (int)(r0 >> (SCREEN_ROW_BITS-1)) | (int)(r1 >> (SCREEN_ROW_BITS-1))<<1;
+		r0 <<= 1;
+		r1 <<= 1;
 	}
-	// glutPostRedisplay();
-	scr_refresh = true;
-	return ret;
 }
 
-void scr_start(int argc, char** argv) { // , void(*callback)(), void(*timer)(int)) {
-	scr_width = 64;
-	scr_height = 32;
-	scr_buf_size = scr_width * scr_height;
-
-	scr_buffer = new unsigned char[scr_buf_size];
-
-	// (x,y) in screen, origin in top-left corner
-	// (x,y) in GL, origin is in center of screen, bottom-left is (-,-), top-right (+,+)
-	// scr_y_factor will invert sign for Y axis
-	scr_x_factor = 2.0f/scr_width;	// = 0.03125
-	scr_y_factor = -2.0f/scr_height;	// y has to be inverted
-
-	scr_pixel_red = 1.0f;
-	scr_pixel_green = 1.0f;
-	scr_pixel_blue = 0.99f;
-
-	for(int i=0; i<scr_buf_size; i++)
-		scr_buffer[i]=0;
-
-	glutInit(&argc, argv);
-
-	// double scr_buffer slows it down... for wahtever reason
-	glutInitDisplayMode(GLUT_DOUBLE | GLUT_RGB | GLUT_DEPTH);
-
-	glutCreateWindow("Chip8");
-	glutInitWindowSize(scr_width*10, scr_height*10);
-	glutInitWindowPosition(50, 50);
-	glutReshapeWindow(scr_width*10, scr_height*10);
-	glClearColor(0.2f, 0.2f, 0.2f, 1.0f); // Set background color to black and opaque
-
-	glutDisplayFunc(scr_display);
-
-	// glutReshapeFunc(fn)
-	// glutKeyboardFunc(fn)
-	// glutSpecialFunc(fn)
-	// glutMouseFunc(fn)
-
-	// glutIdleFunc(scr_display); // dirty trick to make refresh the idel function
-	// 	glutIdleFunc(scr_idle); // more accurate way of doing it
-
-// 	glutIdleFunc(callback); // screen call back
-//
-// 	glut
-// 	glutTimerFunc(1000.0/60.0, timer, 0);	// 60 times a second
-
-// 	glutMainLoop();           				// Enter the event-processing loop
+void Screen::unpack(unsigned char* out) const {
+	for(int y=0; y<height; y++)
+		unpack_row(y, out + y*width);
 }
-
-
-
-
-
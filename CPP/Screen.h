@@ -1,23 +1,92 @@
 // Screen.h
 
-extern unsigned short int scr_width;
-extern unsigned short int scr_height;
-extern unsigned short int scr_buf_size;
-extern const unsigned char SCREEN_PIXEL;
-extern unsigned char* scr_buffer;
-
-// origin at the center of the screen
-// also, range is -1..1 for x and y
-extern float scr_x_factor;
-extern float scr_y_factor;
-
-extern float scr_pixel_red;
-extern float scr_pixel_green;
-extern float scr_pixel_blue;
-
-
-void scr_display();
-void scr_idle();
-void scr_start(int argc, char** argv, void(*callback)());
-void scr_clear();
-bool scr_xor_pixel(int x, int y);
+#ifndef SCREEN_H
+#define SCREEN_H
+
+const unsigned char SCREEN_PIXEL = 0xFF;
+
+// one screen row, 1 bit per pixel, the most significant bit is x=0
+// 128 bits so a hires row fits, a 64 wide screen uses the top half
+typedef unsigned __int128 scr_row;
+const int SCREEN_ROW_BITS = 128;
+
+// lores is the CHIP-8 screen, hires the SUPER-CHIP one
+const int SCREEN_LORES_W = 64;
+const int SCREEN_LORES_H = 32;
+const int SCREEN_HIRES_W = 128;
+const int SCREEN_HIRES_H = 64;
+
+// XO-CHIP has two planes, a pixel's color is its bits in both (0-3)
+const int SCREEN_PLANES = 2;
+
+// Screen buffer of one machine
+// no GL in here, Display.cpp draws it in a window
+class Screen {
+public:
+	unsigned short int width;
+	unsigned short int height;		// at most 64, see dirty
+	scr_row* rows;					// the planes one after the other, see plane()
+	scr_row row_mask;				// the width bits in use
+	unsigned char planes;			// bit p: draw, clear and scroll work on plane p (Fn01)
+
+	// bit y set: row y changed since the last take_dirty()
+	// the host takes it once per frame and hands it to whatever shows the screen
+	unsigned long long dirty;
+
+	Screen();
+	~Screen();
+	Screen(const Screen&) = delete;
+	Screen& operator=(const Screen&) = delete;
+
+	void init();					// lores, plane 0, clear
+	void clear();					// the selected planes
+	void set_hires(bool on);		// switch resolution, clears all planes
+	bool hires() const { return width==SCREEN_HIRES_W; }
+
+	// height rows of plane p (room for SCREEN_HIRES_H)
+	scr_row* plane(int p)				{ return rows + p*SCREEN_HIRES_H; }
+	const scr_row* plane(int p) const	{ return rows + p*SCREEN_HIRES_H; }
+
+	// whole rows of the selected planes at a time, what moves out is gone,
+	// blank comes in
+	void scroll_up(int n);
+	void scroll_down(int n);
+	void scroll_left(int n);
+	void scroll_right(int n);
+
+	// XOR sprite bits into row y of plane p starting at column x, bit 127 of
+	// bits is the left sprite pixel, anything past the right edge is clipped
+	// returns true if a set pixel was cleared (collision)
+	bool xor_row(int p, int x, int y, scr_row bits) {
+		scr_row* row = rows + p*SCREEN_HIRES_H + y;
+		bits = (bits >> x) & row_mask;
+		bool col = (*row & bits)!=0;
+		*row ^= bits;
+		if(bits!=0)
+			dirty |= 1ULL<<y;
+		return col;
+	}
+
+	// bit p: set in plane p
+	int color(int x, int y) const {
+		int c = 0;
+		for(int p=0; p<SCREEN_PLANES; p++)
+			c |= (int)(plane(p)[y] >> (SCREEN_ROW_BITS-1-x) & 1) << p;
+		return c;
+	}
+
+	bool pixel(int x, int y) const { return color(x, y)!=0; }
+
+	unsigned long long take_dirty() {
+		unsigned long long d = dirty;
+		dirty = 0;
+		return d;
+	}
+
+	// 1 byte per pixel, its color, width bytes for a row,
+	// width*height for the screen
+	void unpack_row(int y, unsigned char* out) const;
+	void unpack(unsigned char* out) const;
+};
+
+#endif
@@ -1,43 +1,75 @@
 // Sound.cpp
 
+// OpenAL sink for the audio thread, see Audio.h
+// one source, SOUND_BUFFERS buffers of AUDIO_BLOCK samples in its queue,
+// which bounds the latency to ~25ms
+
 #include <AL/al.h>
 #include <AL/alc.h>
 #include <AL/alut.h>
 #include <stdio.h>
 
-ALuint sound_buffer, sound_source, sound_state;
-ALfloat sound_pitch;
+#include "Sound.h"
 
-void sound_init()
-{
-	alutInit(0, NULL);
-	alGetError();
+const int SOUND_BUFFERS = 4;
 
-	// sound_pitch = 440.0; // default
-	sound_pitch = 880.0;
-}
+class AlSink : public AudioSink {
+public:
+	AlSink() {
+		alGenSources(1, &source);
+		alGenBuffers(SOUND_BUFFERS, buffers);
+		queued = 0;
+	}
+	~AlSink() {
+		alSourceStop(source);
+		alDeleteSources(1, &source);
+		alDeleteBuffers(SOUND_BUFFERS, buffers);
+	}
 
-void sound_start(ALfloat dur)
-{
-	sound_buffer = alutCreateBufferWaveform(ALUT_WAVEFORM_SINE, sound_pitch, 10.0, dur);
+	bool realtime() { return true; }
 
-    alGenSources(1, &sound_source);
-    alSourcei(sound_source, AL_BUFFER, sound_buffer);
-    alSourcePlay(sound_source);
-}
+	bool ready() {
+		if(queued<SOUND_BUFFERS)
+			return true;
+		ALint done = 0;
+		alGetSourcei(source, AL_BUFFERS_PROCESSED, &done);
+		return done>0;
+	}
 
-void sound_check()
-{
-    // Wait for the song to complete
-	alGetSourcei(sound_source, AL_SOURCE_STATE, (int*)&sound_state);
+	void write(const short* s, int n) {
+		ALuint buffer;
+		if(queued<SOUND_BUFFERS)
+			buffer = buffers[queued++];
+		else
+			alSourceUnqueueBuffers(source, 1, &buffer);
+		alBufferData(buffer, AL_FORMAT_MONO16, s, n*sizeof(short), AUDIO_RATE);
+		alSourceQueueBuffers(source, 1, &buffer);
 
-	if(sound_state!=AL_PLAYING) {
-		alDeleteSources(1, &sound_source);
-		alDeleteBuffers(1, &sound_buffer);
+		// first time, or it ran dry and stopped
+		ALint state;
+		alGetSourcei(source, AL_SOURCE_STATE, &state);
+		if(state!=AL_PLAYING)
+			alSourcePlay(source);
 	}
+
+private:
+	ALuint source;
+	ALuint buffers[SOUND_BUFFERS];
+	int queued;					// buffers handed to the source so far
+};
+
+AudioSink* sound_init()
+{
+	if(!alutInit(0, NULL)) {
+		printf("No sound device\n");
+		return NULL;
+	}
+	alGetError();
+	return new AlSink();
 }
 
-void sound_exit()
+void sound_exit(AudioSink* sink)
 {
-    alutExit();
+	delete sink;
+	alutExit();
 }
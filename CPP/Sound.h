@@ -0,0 +1,13 @@
+// Sound.h
+
+#ifndef SOUND_H
+#define SOUND_H
+
+#include "Audio.h"
+
+// OpenAL output for Audio, a source fed from a queue of small buffers
+// NULL if there's no device
+AudioSink* sound_init();
+void sound_exit(AudioSink* sink);	// after the Audio using it is gone
+
+#endif
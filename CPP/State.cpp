@@ -0,0 +1,249 @@
+// State.cpp
+
+// Save states: the whole machine in a small binary, see Chip8.h
+//
+// little endian, version 4:
+//	"C8SS" version:16 quirks:16
+//	V[16] IX:16 PC:16 SP:16 DT ST KEY pitch:16 prog_size:16 exit_code:32
+//	rng:32 (not in version 1)
+//	stack[16]:16
+//	(version 1 and 2: entry_cnt:16 entry[entry_cnt]:16, skipped)
+//	pattern[16] rate pattern_on planes (not before version 4)
+//	width:16 height:16 rows[height]:128, per plane (one plane before version 4)
+// before version 4 the font was at 0x1000, it's put back at FONT_START
+//	page map (STATE_PAGES bits), then STATE_PAGE bytes for every page in it
+// memory pages that are all zero are left out, init() zeroes them anyway
+
+#include <stdio.h>
+#include <string.h>
+
+#include "Chip8.h"
+
+static const char STATE_MAGIC[4] = { 'C', '8', 'S', 'S' };
+static const int STATE_VERSION	= 4;
+static const int STATE_PAGE		= 256;
+static const int STATE_PAGES	= MEM_SIZE/STATE_PAGE;
+
+static void put8(std::vector<byte>& out, int v)		{ out.push_back(v); }
+static void put16(std::vector<byte>& out, int v)	{ out.push_back(v & 0xFF); out.push_back((v>>8) & 0xFF); }
+static void put32(std::vector<byte>& out, int v)	{ put16(out, v & 0xFFFF); put16(out, (v>>16) & 0xFFFF); }
+
+// reads past the end give 0 and set bad, checked once at the end
+struct StateReader {
+	const byte* p;
+	const byte* end;
+	bool bad;
+
+	int get8()	{ if(p>=end) { bad = true; return 0; } return *p++; }
+	int get16()	{ int v = get8(); return v | get8()<<8; }
+	int get32()	{ int v = get16(); return v | get16()<<16; }
+	const byte* get(int n) {
+		if(end-p < n) {
+			bad = true;
+			return NULL;
+		}
+		const byte* r = p;
+		p += n;
+		return r;
+	}
+};
+
+static bool page_zero(const byte* page)
+{
+	const unsigned long long* w = (const unsigned long long*)page;
+	for(int i=0; i<STATE_PAGE/8; i++)
+		if(w[i]!=0)
+			return false;
+	return true;
+}
+
+void Chip8::save_state(std::vector<byte>& out) const
+{
+	out.clear();
+	for(int i=0; i<4; i++)
+		put8(out, STATE_MAGIC[i]);
+	put16(out, STATE_VERSION);
+	put16(out, quirks);
+
+	for(int i=0; i<16; i++)
+		put8(out, V[i]);
+	put16(out, IX);
+	put16(out, PC);
+	put16(out, SP);
+	put8(out, DT);
+	put8(out, ST);
+	put8(out, KEY);
+	put16(out, pitch);
+	put16(out, prog_size);
+	put32(out, exit_code);
+	put32(out, rng);
+
+	for(int i=0; i<STACK_SIZE; i++)
+		put16(out, stack[i]);
+
+	for(int i=0; i<16; i++)
+		put8(out, pattern[i]);
+	put8(out, rate);
+	put8(out, pattern_on);
+	put8(out, screen.planes);
+
+	put16(out, screen.width);
+	put16(out, screen.height);
+	for(int p=0; p<SCREEN_PLANES; p++)
+		for(int y=0; y<screen.height; y++)
+			for(int b=SCREEN_ROW_BITS-8; b>=0; b-=8)
+				put8(out, (int)(screen.plane(p)[y]>>b) & 0xFF);
+
+	byte map[STATE_PAGES/8];
+	memset(map, 0, sizeof(map));
+	for(int i=0; i<STATE_PAGES; i++)
+		if(!page_zero(mem + i*STATE_PAGE))
+			map[i/8] |= 1<<(i%8);
+	out.insert(out.end(), map, map+sizeof(map));
+	for(int i=0; i<STATE_PAGES; i++)
+		if(map[i/8] & 1<<(i%8))
+			out.insert(out.end(), mem + i*STATE_PAGE, mem + (i+1)*STATE_PAGE);
+}
+
+// replaces the whole machine, no init() or load needed before
+// a bad or foreign snapshot leaves the machine as it was
+bool Chip8::load_state(const byte* data, int size)
+{
+	StateReader in = { data, data+size, false };
+
+	const byte* magic = in.get(4);
+	if(magic==NULL || memcmp(magic, STATE_MAGIC, 4)!=0) {
+		printf("Not a save state\n");
+		return false;
+	}
+	int version = in.get16();
+	if(version<1 || version>STATE_VERSION) {
+		printf("Save state version %d, can only read up to %d\n", version, STATE_VERSION);
+		return false;
+	}
+
+	// check the variable sized parts and the values the machine indexes
+	// with (PC, SP, prog_size) before touching anything
+	const byte* start = in.p;
+	in.p += 2 + 16 + 2;
+	int pc = in.get16();
+	int sp = in.get16();
+	in.p += 3 + 2;
+	int prog = in.get16();
+	in.p += 4 + (version>=2 ? 4 : 0) + STACK_SIZE*2;
+	int n_entry = version<3 ? in.get16() : 0;
+	in.p += n_entry*2;
+	int planes = version>=4 ? SCREEN_PLANES : 1;
+	in.p += version>=4 ? 16 + 3 : 0;
+	int width = in.get16();
+	int height = in.get16();
+	in.p += planes*height*SCREEN_ROW_BITS/8;
+	const byte* map = in.get(STATE_PAGES/8);
+	int pages = 0;
+	for(int i=0; i<STATE_PAGES && map!=NULL; i++)
+		if(map[i/8] & 1<<(i%8))
+			pages++;
+	in.get(pages*STATE_PAGE);
+	bool lores = width==SCREEN_LORES_W && height==SCREEN_LORES_H;
+	bool hires = width==SCREEN_HIRES_W && height==SCREEN_HIRES_H;
+	bool regs_ok = pc<MEM_SIZE && sp<=STACK_SIZE && prog<=PROG_MAX_SIZE;
+	if(in.bad || !(lores || hires) || !regs_ok) {
+		printf("Save state is damaged or doesn't fit this machine\n");
+		return false;
+	}
+
+	in.p = start;
+	use_quirks(in.get16());
+
+	for(int i=0; i<16; i++)
+		V[i] = in.get8();
+	IX = in.get16();
+	PC = in.get16();
+	SP = in.get16();
+	DT = in.get8();
+	ST = in.get8();
+	KEY = in.get8();
+	pitch = in.get16();
+	prog_size = in.get16();
+	exit_code = in.get32();
+	halted = false;
+	if(version>=2)
+		rng = in.get32();
+
+	for(int i=0; i<STACK_SIZE; i++)
+		stack[i] = in.get16();
+	if(version<3) {
+		int skip = in.get16()*2;
+		in.p += skip;
+	}
+
+	pattern_on = false;
+	rate = 64;
+	if(version>=4) {
+		for(int i=0; i<16; i++)
+			pattern[i] = in.get8();
+		rate = in.get8();
+		pattern_on = in.get8()!=0;
+	}
+	int sel = version>=4 ? in.get8() & 3 : 1;
+
+	in.get16();		// width, height, checked above
+	in.get16();
+	screen.set_hires(hires);		// clears both planes
+	screen.planes = sel;
+	for(int p=0; p<planes; p++)
+		for(int y=0; y<screen.height; y++) {
+			scr_row r = 0;
+			for(int b=0; b<SCREEN_ROW_BITS/8; b++)
+				r = r<<8 | in.get8();
+			screen.plane(p)[y] = r;
+		}
+	screen.dirty = ~0ULL >> (64-screen.height);
+
+	in.get(STATE_PAGES/8);
+	for(int i=0; i<STATE_PAGES; i++) {
+		byte* page = mem + i*STATE_PAGE;
+		if(map[i/8] & 1<<(i%8))
+			memcpy(page, in.get(STATE_PAGE), STATE_PAGE);
+		else
+			memset(page, 0, STATE_PAGE);
+	}
+	if(version<4)
+		load_fonts();
+
+	flush_code();
+	analyze();
+	return true;
+}
+
+bool Chip8::save_state_file(const char* filename) const
+{
+	std::vector<byte> data;
+	save_state(data);
+
+	FILE* file = fopen(filename, "wb");
+	if(file==NULL) {
+		printf("Can't write [%s]\n", filename);
+		return false;
+	}
+	bool ok = fwrite(data.data(), 1, data.size(), file)==data.size();
+	ok = fclose(file)==0 && ok;
+	return ok;
+}
+
+bool Chip8::load_state_file(const char* filename)
+{
+	FILE* file = fopen(filename, "rb");
+	if(file==NULL) {
+		printf("File not found [%s]\n", filename);
+		return false;
+	}
+	std::vector<byte> data;
+	byte buf[4096];
+	int n;
+	while((n = fread(buf, 1, sizeof(buf), file))>0)
+		data.insert(data.end(), buf, buf+n);
+	fclose(file);
+
+	return load_state(data.data(), data.size());
+}
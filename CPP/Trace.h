@@ -0,0 +1,46 @@
+// Trace.h
+
+// Trace print macros, selected at compile time by TRACE_LEVEL
+// a disabled level is removed by the preprocessor, arguments and all,
+// so a production build pays nothing for it
+//
+//	0	off		nothing
+//	1	ops		address, opcode and mnemonic per instruction
+//	2	regs	+ changed registers, PC and stack
+//	3	full	+ memory, timers, keys and random numbers (the old printf everything)
+//
+// make TRACE=3 for the old output
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdio.h>
+
+#define TRACE_LVL_OFF	0
+#define TRACE_LVL_OPS	1
+#define TRACE_LVL_REGS	2
+#define TRACE_LVL_FULL	3
+
+#ifndef TRACE_LEVEL
+#define TRACE_LEVEL		TRACE_LVL_OFF
+#endif
+
+#if TRACE_LEVEL>=TRACE_LVL_OPS
+#define TRACE_OPS(...)	printf(__VA_ARGS__)
+#else
+#define TRACE_OPS(...)	do {} while(0)
+#endif
+
+#if TRACE_LEVEL>=TRACE_LVL_REGS
+#define TRACE_REGS(...)	printf(__VA_ARGS__)
+#else
+#define TRACE_REGS(...)	do {} while(0)
+#endif
+
+#if TRACE_LEVEL>=TRACE_LVL_FULL
+#define TRACE_FULL(...)	printf(__VA_ARGS__)
+#else
+#define TRACE_FULL(...)	do {} while(0)
+#endif
+
+#endif
@@ -0,0 +1,147 @@
+// TraceDiff.cpp
+
+// first instruction where two binary traces (Program -t) part ways
+// identical blocks are compared as bytes, only the block with the difference
+// is decoded, neither trace is read into memory as a whole
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <string>
+
+#include "Cfg.h"
+#include "Tracer.h"
+
+int context = 5;			// -C: instructions before and after
+
+void usage(const char* name)
+{
+	printf("usage: %s [-C n] a.c8tr b.c8tr\n", name);
+	printf("\t-C\tinstructions of context around the difference (default %d)\n", context);
+	printf("\texit code 0: same, 1: different, 2: error\n");
+}
+
+bool same(const TraceRec& a, const TraceRec& b)
+{
+	if(a.pc!=b.pc || a.op!=b.op || a.flags!=b.flags || a.vmask!=b.vmask)
+		return false;
+	for(int i=0; i<16; i++)
+		if((a.vmask & 1<<i) && a.V[i]!=b.V[i])
+			return false;
+	if((a.flags & TR_IX) && a.IX!=b.IX)
+		return false;
+	if((a.flags & TR_SP) && (a.SP!=b.SP || a.top!=b.top))
+		return false;
+	if((a.flags & TR_TIMER) && (a.DT!=b.DT || a.ST!=b.ST))
+		return false;
+	if((a.flags & TR_MEM) && (a.mem_addr!=b.mem_addr || a.mem_n!=b.mem_n || memcmp(a.mem, b.mem, a.mem_n)!=0))
+		return false;
+	if((a.flags & TR_KEY) && a.KEY!=b.KEY)
+		return false;
+	return true;
+}
+
+void print_state(const char* name, const Chip8& chip)
+{
+	printf("%s\tPC:%04X IX:%04X SP:%02X DT:%02X ST:%02X V:", name, chip.PC, chip.IX, chip.SP, chip.DT, chip.ST);
+	for(int i=0; i<16; i++)
+		printf(" %02X", chip.V[i]);
+	printf("\n");
+}
+
+// lines around instruction at, and the registers before it
+void show(const char* name, TraceReader& in, long long at)
+{
+	printf("\n--- %s\n", name);
+	Chip8 chip;
+	if(in.state_at(at, chip))
+		print_state("before", chip);
+
+	std::string mem(PROG_END, 0);
+	memcpy(&mem[PROG_START], in.prog, in.prog_size);
+	Cfg cfg;
+	cfg.analyze((const byte*)mem.data(), PROG_END, PROG_START, in.prog_size, (chip.quirks & QUIRK_LONGI)!=0);
+
+	long long from = at>context ? at-context : 0;
+	if(!in.state_at(from, chip))
+		return;
+	char line[TRACE_TEXT_MAX];
+	TraceRec rec;
+	while(in.next(rec) && rec.n<=at+context) {
+		trace_apply(rec, chip);
+		trace_text(rec, chip, cfg, line);
+		printf("%c %lld\t%s", rec.n==at ? '>' : ' ', rec.n, line);
+	}
+}
+
+int main(int argc, char** argv)
+{
+	const char* files[2] = { NULL, NULL };
+	int nfiles = 0;
+	for(int i=1; i<argc; i++) {
+		char* arg = argv[i];
+		if(strcmp(arg, "-C")==0 && i+1<argc)
+			context = atoi(argv[++i]);
+		else if(arg[0]=='-' || nfiles==2) {
+			usage(argv[0]);
+			return 2;
+		} else
+			files[nfiles++] = arg;
+	}
+	if(nfiles!=2) {
+		usage(argv[0]);
+		return 2;
+	}
+	if(context<0)
+		context = 0;
+
+	TraceReader a, b;
+	if(!a.open(files[0]) || !b.open(files[1]))
+		return 2;
+	if(a.prog_size!=b.prog_size || memcmp(a.prog, b.prog, a.prog_size)!=0)
+		printf("note: the traces are of different programs\n");
+
+	// skip the blocks that are the same byte for byte
+	long long diff = -1;
+	while(diff<0) {
+		bool more_a = a.next_block();
+		bool more_b = b.next_block();
+		if(!more_a && !more_b)
+			break;
+		if(more_a && more_b && a.same_block(b))
+			continue;
+
+		// decode this one, records from the start of the block
+		TraceRec ra, rb;
+		while(true) {
+			bool ha = more_a && a.next(ra);
+			bool hb = more_b && b.next(rb);
+			if(!ha && !hb)
+				break;
+			if(ha!=hb || !same(ra, rb)) {
+				diff = ha ? ra.n : rb.n;
+				break;
+			}
+			// a block is never split, so both run out together or differ
+			if(a.block_first()!=b.block_first())
+				break;
+		}
+		if(diff<0 && (more_a!=more_b))
+			diff = more_a ? a.block_first() : b.block_first();
+	}
+	// a run that crashed leaves a trace cut short, compare what is there
+	if(a.bad)
+		printf("note: %s is cut short\n", files[0]);
+	if(b.bad)
+		printf("note: %s is cut short\n", files[1]);
+	if(diff<0) {
+		printf("same\n");
+		return 0;
+	}
+
+	printf("first difference at instruction %lld\n", diff);
+	show(files[0], a, diff);
+	show(files[1], b, diff);
+	return 1;
+}
@@ -0,0 +1,98 @@
+// TraceDump.cpp
+
+// binary trace (Program -t) to text, one line per instruction, see Tracer.h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <string>
+
+#include "Cfg.h"
+#include "Tracer.h"
+
+long long start = 0;		// -s: first instruction
+long long limit = -1;		// -c: instructions, -1: to the end
+bool show_state = false;	// -m: machine registers before the first one
+
+void usage(const char* name)
+{
+	printf("usage: %s [-s first] [-c count] [-m] trace\n", name);
+	printf("\t-s\tstart at instruction first (from 0), a seek with the index\n");
+	printf("\t-c\tonly count instructions\n");
+	printf("\t-m\tregisters before the first instruction, from the nearest checkpoint\n");
+}
+
+void print_state(const Chip8& chip, long long n)
+{
+	printf("; before %lld: PC:%04X IX:%04X SP:%02X DT:%02X ST:%02X V:", n, chip.PC, chip.IX, chip.SP, chip.DT, chip.ST);
+	for(int i=0; i<16; i++)
+		printf(" %02X", chip.V[i]);
+	printf("\n");
+}
+
+int main(int argc, char** argv)
+{
+	const char* trace = NULL;
+	for(int i=1; i<argc; i++) {
+		char* arg = argv[i];
+		bool has_val = i+1<argc;
+		if(strcmp(arg, "-s")==0 && has_val)
+			start = atoll(argv[++i]);
+		else if(strcmp(arg, "-c")==0 && has_val)
+			limit = atoll(argv[++i]);
+		else if(strcmp(arg, "-m")==0)
+			show_state = true;
+		else if(arg[0]=='-' || trace!=NULL) {
+			usage(argv[0]);
+			return 1;
+		} else
+			trace = arg;
+	}
+	if(trace==NULL) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	TraceReader in;
+	if(!in.open(trace))
+		return 1;
+	// the machine is kept up to date along the way, the text needs it
+	Chip8 chip;
+	if(!in.state_at(start, chip)) {
+		fprintf(stderr, "No instruction %lld in the trace\n", start);
+		return 1;
+	}
+	if(show_state)
+		print_state(chip, start);
+
+	// labels for "@", from the program the trace was made with
+	std::string mem(PROG_END, 0);
+	memcpy(&mem[PROG_START], in.prog, in.prog_size);
+	Cfg cfg;
+	cfg.analyze((const byte*)mem.data(), PROG_END, PROG_START, in.prog_size, (chip.quirks & QUIRK_LONGI)!=0);
+
+	// a batch of lines per fwrite
+	std::string out;
+	out.reserve(1<<20);
+	char line[TRACE_TEXT_MAX];
+	TraceRec rec;
+	rec.n = start;
+	for(long long i=0; limit<0 || i<limit; i++) {
+		if(!in.next(rec))
+			break;
+		trace_apply(rec, chip);
+		out.append(line, trace_text(rec, chip, cfg, line));
+		if(out.size()>(1<<20)-TRACE_TEXT_MAX) {
+			fwrite(out.data(), 1, out.size(), stdout);
+			out.clear();
+		}
+	}
+	fwrite(out.data(), 1, out.size(), stdout);
+
+	if(in.bad) {
+		fprintf(stderr, "Trace file is damaged after instruction %lld\n", rec.n);
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,705 @@
+// Tracer.cpp
+
+// binary trace writer, reader and text, see Tracer.h
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "Dis.h"
+#include "Tracer.h"
+
+static const char TRACE_MAGIC[4] = { 'C', '8', 'T', 'R' };
+static const char INDEX_MAGIC[4] = { 'C', '8', 'I', 'X' };
+static const int TRACE_VERSION = 2;
+static const int TRACE_HEAD = 12;
+static const int STATE_MAX = MEM_SIZE + 4096;		// bigger than any save state
+
+static inline byte* put16(byte* p, int v)	{ p[0] = v & 0xFF; p[1] = (v>>8) & 0xFF; return p+2; }
+static inline byte* put32(byte* p, unsigned int v)	{ p = put16(p, v & 0xFFFF); return put16(p, v>>16); }
+static inline int get16(const byte* p)	{ return p[0] | p[1]<<8; }
+static inline unsigned int get32(const byte* p)	{ return get16(p) | (unsigned int)get16(p+2)<<16; }
+static inline long long get64(const byte* p)	{ return get32(p) | (long long)get32(p+4)<<32; }
+
+static void trace_sleep()
+{
+	timespec t = { 0, 1000000 };	// 1 ms
+	nanosleep(&t, NULL);
+}
+
+
+Tracer::Tracer(Chip8* c, const char* filename)
+{
+	chip = c;
+	failed = false;
+	cur = NULL;
+	block = NULL;
+	block_cnt = 0;
+	count = 0;
+	last_key = chip->KEY;
+	allocated = 0;
+	file_pos = TRACE_HEAD + chip->prog_size;
+
+	file = fopen(filename, "wb");
+	if(file==NULL) {
+		printf("Can't write [%s]\n", filename);
+		return;
+	}
+
+	byte head[TRACE_HEAD];
+	memcpy(head, TRACE_MAGIC, 4);
+	put16(head+4, TRACE_VERSION);
+	put16(head+6, TRACE_BLOCK);
+	put16(head+8, TRACE_CHECKPOINT);
+	put16(head+10, chip->prog_size);
+	fwrite(head, 1, sizeof(head), file);
+	fwrite(chip->mem+PROG_START, 1, chip->prog_size, file);
+
+	running = true;
+	thread = std::thread(&Tracer::write_loop, this);
+	chip->tracer = this;
+}
+
+Tracer::~Tracer()
+{
+	if(chip->tracer==this)
+		chip->tracer = NULL;
+	if(file==NULL)
+		return;
+
+	if(cur!=NULL) {
+		close_block();
+		while(!full.push(cur))
+			std::this_thread::yield();
+	}
+	running = false;
+	thread.join();
+	write_index();
+
+	Chunk* c;
+	while(empty.pop(c)) {
+		delete[] c->data;
+		delete c;
+	}
+	if(fclose(file)!=0)
+		failed = true;
+	if(failed)
+		printf("Trace file is incomplete, write failed\n");
+}
+
+// the writer drains everything that was handed off before it stops
+void Tracer::write_loop()
+{
+	while(true) {
+		Chunk* c;
+		if(full.pop(c)) {
+			if(fwrite(c->data, 1, c->used, file)!=(size_t)c->used)
+				failed = true;
+			c->used = 0;
+			empty.push(c);
+		} else if(!running)
+			break;
+		else
+			trace_sleep();
+	}
+}
+
+// cur to the writer, a free chunk (or a new one) in its place
+void Tracer::hand_off()
+{
+	if(cur!=NULL)
+		while(!full.push(cur))
+			std::this_thread::yield();
+	cur = NULL;
+
+	while(!empty.pop(cur)) {
+		if(allocated<CHUNKS) {
+			allocated++;
+			cur = new Chunk;
+			cur->data = new byte[CHUNK_SIZE];
+			cur->used = 0;
+			return;
+		}
+		// the disk is behind, wait for it
+		std::this_thread::yield();
+	}
+}
+
+void Tracer::open_block()
+{
+	if(index.size()%TRACE_CHECKPOINT==0)
+		chip->save_state(state);
+	else
+		state.clear();
+
+	if(cur==NULL || CHUNK_SIZE-cur->used < TRACE_BLOCK_HEAD + (int)state.size() + TRACE_BLOCK*TRACE_REC_MAX)
+		hand_off();
+	block = cur->data + cur->used;
+	put32(block+16, state.size());
+	memcpy(block+TRACE_BLOCK_HEAD, state.data(), state.size());
+	cur->used += TRACE_BLOCK_HEAD + state.size();
+	block_cnt = 0;
+}
+
+void Tracer::close_block()
+{
+	if(block==NULL)
+		return;
+	unsigned long long first = count-block_cnt;
+	int size = cur->data + cur->used - block;
+	put32(put32(block, first & 0xFFFFFFFF), first>>32);
+	put32(block+8, block_cnt);
+	put32(block+12, size - TRACE_BLOCK_HEAD - get32(block+16));
+	index.push_back(file_pos);
+	file_pos += size;
+	block = NULL;
+}
+
+// after the last block, the writer thread is done by now
+void Tracer::write_index()
+{
+	std::vector<byte> out(index.size()*8 + 16);
+	byte* p = out.data();
+	for(long long off : index)
+		p = put32(put32(p, off & 0xFFFFFFFF), off>>32);
+	p = put32(p, index.size());
+	p = put32(put32(p, count & 0xFFFFFFFF), count>>32);
+	memcpy(p, INDEX_MAGIC, 4);
+	if(fwrite(out.data(), 1, out.size(), file)!=out.size())
+		failed = true;
+}
+
+bool Tracer::step()
+{
+	if(block==NULL)
+		open_block();
+
+	word pc = chip->PC;
+	word op = (chip->mem[pc]<<8) | chip->mem[pc+1];
+	byte V[16];
+	memcpy(V, chip->V, 16);
+	word IX = chip->IX;
+	word SP = chip->SP;
+	byte DT = chip->DT;
+	byte ST = chip->ST;
+	byte KEY = chip->KEY;
+
+	bool ok = chip->exec1();
+	// exec1() leaves PC on an instruction that ran off the end of memory
+	bool end = !ok && chip->PC==pc && pc<PROG_START+chip->prog_size;
+
+	byte* p = cur->data + cur->used;
+	p = put16(p, pc);
+	p = put16(p, op);
+	byte* flags = p++;
+	byte f = 0;
+
+	// changed V bytes, 8 at a time
+	unsigned long long d[2], now[2];
+	memcpy(now, chip->V, 16);
+	memcpy(d, V, 16);
+	d[0] ^= now[0];
+	d[1] ^= now[1];
+	if((d[0] | d[1])!=0) {
+		f |= TR_V;
+		byte* mask = p;
+		p += 2;
+		int m = 0;
+		for(int h=0; h<2; h++)
+			while(d[h]!=0) {
+				int i = h*8 + __builtin_ctzll(d[h])/8;
+				d[h] &= ~(0xFFULL << (i%8)*8);
+				m |= 1<<i;
+				*p++ = chip->V[i];
+			}
+		put16(mask, m);
+	}
+	// F000 that didn't stop, or ran off the end of memory, is XO-CHIP long
+	// IX, always recorded so the text has its operand
+	if(IX!=chip->IX || (op==0xF000 && (ok || end))) {
+		f |= TR_IX;
+		p = put16(p, chip->IX);
+	}
+	if(SP!=chip->SP) {
+		f |= TR_SP;
+		*p++ = chip->SP;
+		p = put16(p, chip->SP>0 ? chip->stack[chip->SP-1] : 0);
+	}
+	if(DT!=chip->DT || ST!=chip->ST) {
+		f |= TR_TIMER;
+		*p++ = chip->DT;
+		*p++ = chip->ST;
+	}
+	// the only instructions that write memory
+	int n = 0;
+	if((op & 0xF0FF)==0xF055)
+		n = ((op>>8) & 0xF) + 1;
+	else if((op & 0xF0FF)==0xF033)
+		n = 3;
+	else if((op & 0xF00F)==0x5002)
+		n = abs(((op>>8) & 0xF) - ((op>>4) & 0xF)) + 1;
+	if(IX+n>MEM_SIZE)
+		n = MEM_SIZE-IX;
+	if(n>0) {
+		f |= TR_MEM;
+		p = put16(p, IX);
+		*p++ = n;
+		memcpy(p, chip->mem+IX, n);
+		p += n;
+	}
+	if(KEY!=last_key) {
+		f |= TR_KEY;
+		*p++ = KEY;
+		last_key = KEY;
+	}
+	if(!ok)
+		f |= TR_HALT;
+	if(end)
+		f |= TR_END;
+	*flags = f;
+
+	cur->used = p - cur->data;
+	count++;
+	if(++block_cnt==TRACE_BLOCK)
+		close_block();
+	return ok;
+}
+
+// same contract as Chip8::run()
+long long Tracer::run(long long max_instr)
+{
+	long long cnt = 0;
+	while(cnt<max_instr) {
+		cnt++;
+		if(!step()) {
+			chip->halted = true;
+			break;
+		}
+	}
+	return cnt;
+}
+
+
+TraceReader::TraceReader()
+{
+	file = NULL;
+	prog_size = 0;
+	count = -1;
+	bad = false;
+	data_start = 0;
+	data_end = -1;
+	block = TRACE_BLOCK;
+	checkpoint = TRACE_CHECKPOINT;
+	pos = 0;
+	left = 0;
+	first = 0;
+	n = 0;
+}
+
+TraceReader::~TraceReader()
+{
+	if(file!=NULL)
+		fclose(file);
+}
+
+bool TraceReader::open(const char* filename)
+{
+	file = fopen(filename, "rb");
+	if(file==NULL) {
+		printf("File not found [%s]\n", filename);
+		return false;
+	}
+	setvbuf(file, NULL, _IOFBF, 1<<20);
+
+	byte head[TRACE_HEAD];
+	if(fread(head, 1, sizeof(head), file)!=sizeof(head) || memcmp(head, TRACE_MAGIC, 4)!=0) {
+		printf("Not a trace file [%s]\n", filename);
+		return false;
+	}
+	if(get16(head+4)!=TRACE_VERSION) {
+		printf("Trace version %d, can only read %d\n", get16(head+4), TRACE_VERSION);
+		return false;
+	}
+	block = get16(head+6);
+	checkpoint = get16(head+8);
+	prog_size = get16(head+10);
+	if(block<1 || block>TRACE_BLOCK || checkpoint<1 || prog_size>PROG_MAX_SIZE
+			|| fread(prog, 1, prog_size, file)!=(size_t)prog_size) {
+		printf("Trace file is damaged [%s]\n", filename);
+		return false;
+	}
+	data_start = TRACE_HEAD + prog_size;
+
+	// the index, if the writer got to the end
+	byte tail[16];
+	if(fseek(file, -16, SEEK_END)==0 && fread(tail, 1, 16, file)==16
+			&& memcmp(tail+12, INDEX_MAGIC, 4)==0) {
+		int blocks = get32(tail);
+		long long end = ftell(file);
+		if(blocks>=0 && end - 16 - blocks*8LL >= data_start
+				&& fseek(file, end - 16 - blocks*8LL, SEEK_SET)==0) {
+			std::vector<byte> raw(blocks*8);
+			if(fread(raw.data(), 1, raw.size(), file)==raw.size()) {
+				index.resize(blocks);
+				for(int i=0; i<blocks; i++)
+					index[i] = get64(raw.data() + i*8);
+				count = get64(tail+4);
+				data_end = end - 16 - blocks*8LL;
+			}
+		}
+	}
+	fseek(file, data_start, SEEK_SET);
+	return true;
+}
+
+// no index at the end: hop from block header to block header
+void TraceReader::scan_index()
+{
+	index.clear();
+	count = 0;
+	long long off = data_start;
+	byte head[TRACE_BLOCK_HEAD];
+	while(fseek(file, off, SEEK_SET)==0 && fread(head, 1, sizeof(head), file)==sizeof(head)) {
+		long long size = TRACE_BLOCK_HEAD + (long long)get32(head+12) + get32(head+16);
+		if(fseek(file, off+size-1, SEEK_SET)!=0 || fgetc(file)==EOF)
+			break;			// cut off in the middle
+		index.push_back(off);
+		count = get64(head) + get32(head+8);
+		off += size;
+	}
+}
+
+bool TraceReader::read_block()
+{
+	if(data_end>=0 && ftell(file)>=data_end)
+		return false;
+	byte head[TRACE_BLOCK_HEAD];
+	size_t got = fread(head, 1, sizeof(head), file);
+	if(got==0)
+		return false;
+	first = n = get64(head);
+	left = get32(head+8);
+	unsigned int bytes = get32(head+12);
+	unsigned int state = get32(head+16);
+	if(got!=sizeof(head) || left>block || bytes>(unsigned)block*TRACE_REC_MAX || state>(unsigned)STATE_MAX) {
+		bad = true;
+		return false;
+	}
+	state_buf.resize(state);
+	buf.resize(bytes);
+	if(fread(state_buf.data(), 1, state, file)!=state || fread(buf.data(), 1, bytes, file)!=bytes) {
+		bad = true;
+		return false;
+	}
+	pos = 0;
+	return true;
+}
+
+bool TraceReader::next(TraceRec& rec)
+{
+	while(left==0)
+		if(bad || file==NULL || !read_block())
+			return false;
+
+	// a block holds whole records, the writer never splits one
+	const byte* p = buf.data() + pos;
+	const byte* end = buf.data() + buf.size();
+	if(end-p < 5) {
+		bad = true;
+		return false;
+	}
+	rec.n = n++;
+	rec.pc = get16(p);
+	rec.op = get16(p+2);
+	rec.flags = p[4];
+	p += 5;
+	if(rec.flags & TR_V) {
+		rec.vmask = get16(p);
+		p += 2;
+		for(int i=0; i<16; i++)
+			if(rec.vmask & 1<<i)
+				rec.V[i] = *p++;
+	} else
+		rec.vmask = 0;
+	if(rec.flags & TR_IX) {
+		rec.IX = get16(p);
+		p += 2;
+	}
+	if(rec.flags & TR_SP) {
+		rec.SP = p[0];
+		rec.top = get16(p+1);
+		p += 3;
+	}
+	if(rec.flags & TR_TIMER) {
+		rec.DT = p[0];
+		rec.ST = p[1];
+		p += 2;
+	}
+	if(rec.flags & TR_MEM) {
+		if(end-p < 3 || end-p < 3+p[2]) {
+			bad = true;
+			return false;
+		}
+		rec.mem_addr = get16(p);
+		rec.mem_n = p[2] > 16 ? 16 : p[2];
+		memcpy(rec.mem, p+3, rec.mem_n);
+		p += 3 + p[2];
+	} else
+		rec.mem_n = 0;
+	if(rec.flags & TR_KEY)
+		rec.KEY = *p++;
+	if(p>end) {
+		bad = true;
+		return false;
+	}
+	pos = p - buf.data();
+	left--;
+	return true;
+}
+
+bool TraceReader::next_block()
+{
+	left = 0;
+	return !bad && file!=NULL && read_block();
+}
+
+bool TraceReader::same_block(const TraceReader& other) const
+{
+	return first==other.first && left==other.left && buf==other.buf;
+}
+
+bool TraceReader::seek(long long to)
+{
+	if(file==NULL || to<0)
+		return false;
+	if(count<0)
+		scan_index();
+	long long b = to/block;
+	if(to>=count || b>=(long long)index.size())
+		return false;
+
+	bad = false;
+	left = 0;
+	if(fseek(file, index[b], SEEK_SET)!=0 || !read_block())
+		return false;
+	TraceRec rec;
+	while(n<to)
+		if(!next(rec))
+			return false;
+	return true;
+}
+
+bool TraceReader::state_at(long long to, Chip8& chip)
+{
+	if(!seek(to))
+		return false;
+	long long b = to/block;
+	long long cb = b - b%checkpoint;
+	if(fseek(file, index[cb], SEEK_SET)!=0 || !read_block() || state_buf.empty())
+		return false;
+	if(!chip.load_state(state_buf.data(), state_buf.size()))
+		return false;
+
+	TraceRec rec;
+	while(n<to) {
+		if(!next(rec))
+			return false;
+		trace_apply(rec, chip);
+	}
+	chip.flush_code();
+	if(!next(rec))
+		return false;
+	chip.PC = rec.pc;
+	return seek(to);
+}
+
+static const char hex[] = "0123456789ABCDEF";
+
+static char* put_hex(char* p, int v, int digits)
+{
+	for(int s=(digits-1)*4; s>=0; s-=4)
+		*p++ = hex[(v>>s) & 0xF];
+	return p;
+}
+
+static char* put_str(char* p, const char* s)
+{
+	while(*s)
+		*p++ = *s++;
+	return p;
+}
+
+void trace_apply(const TraceRec& rec, Chip8& chip)
+{
+	for(int i=0; i<16; i++)
+		if(rec.vmask & 1<<i)
+			chip.V[i] = rec.V[i];
+	if(rec.flags & TR_IX)
+		chip.IX = rec.IX;
+	if(rec.flags & TR_SP) {
+		chip.SP = rec.SP;
+		if(rec.SP>0 && rec.SP<=STACK_SIZE)
+			chip.stack[rec.SP-1] = rec.top;
+	}
+	if(rec.flags & TR_TIMER) {
+		chip.DT = rec.DT;
+		chip.ST = rec.ST;
+	}
+	if((rec.flags & TR_MEM) && rec.mem_addr + rec.mem_n <= MEM_SIZE)
+		memcpy(chip.mem + rec.mem_addr, rec.mem, rec.mem_n);
+	if(rec.flags & TR_KEY)
+		chip.KEY = rec.KEY;
+}
+
+// "\t[PC:0242,SP:01,stack:(02C0)]", Chip8::print_stack()
+static char* put_stack(char* p, word pc, const Chip8& chip)
+{
+	p = put_str(p, "\t[PC:");
+	p = put_hex(p, pc, 4);
+	p = put_str(p, ",SP:");
+	p = put_hex(p, chip.SP, 2);
+	p = put_str(p, ",stack:(");
+	for(int i=0; i<chip.SP && i<STACK_SIZE; i++) {
+		if(i>0)
+			*p++ = ' ';
+		p = put_hex(p, chip.stack[i], 4);
+	}
+	return put_str(p, ")]");
+}
+
+// "\t[?2B=2B,PC:0268]", only when it skipped, the PC after it
+static char* put_skip(char* p, const TraceRec& rec, const Chip8& chip, byte v1, byte v2, bool equal)
+{
+	if((v1==v2)!=equal)
+		return p;
+	word pc = rec.pc+2;
+	if((chip.quirks & QUIRK_LONGI) && chip.mem[pc]==0xF0 && chip.mem[(word)(pc+1)]==0x00)
+		pc += 2;
+	pc += 2;
+	p = put_str(p, "\t[?");
+	p = put_hex(p, v1, 2);
+	*p++ = '=';
+	p = put_hex(p, v2, 2);
+	p = put_str(p, ",PC:");
+	p = put_hex(p, pc, 4);
+	return put_str(p, "]");
+}
+
+// "\t[r6:2A", the rest is up to the caller
+static char* put_reg(char* p, int reg, byte v)
+{
+	p = put_str(p, "\t[r");
+	*p++ = hex[reg];
+	*p++ = ':';
+	return put_hex(p, v, 2);
+}
+
+// the TRACE_REGS text of the instruction, with the messages of the ones that
+// stop the machine, chip is the machine after it
+static char* put_regs(char* p, const TraceRec& rec, const Chip8& chip)
+{
+	char msg[64];
+	word op = rec.op;
+	int x = (op>>8) & 0xF;
+	int y = (op>>4) & 0xF;
+	byte nn = op & 0xFF;
+	bool halt = (rec.flags & (TR_HALT|TR_END))==TR_HALT;
+
+	// most that stop are undefined or Fx00, they print nothing
+	if(halt) {
+		msg[0] = 0;
+		if(op==0x00EE)
+			strcpy(msg, "Empty stack\n");
+		else if((op & 0xF000)==0x2000)
+			snprintf(msg, sizeof(msg), "Stack full SP:%d\n", chip.SP);
+		else if((op & 0xF0FF)==0xF055 || (op & 0xF0FF)==0xF065)
+			snprintf(msg, sizeof(msg), "Out of memory IX:%X\n", MEM_SIZE);
+		return put_str(p, msg);
+	}
+
+	switch(op>>12) {
+		case 0x0:
+			if(op==0x00EE)		// RET, the address it popped is still there
+				p = put_stack(p, chip.SP<STACK_SIZE ? chip.stack[chip.SP] : 0, chip);
+			break;
+		case 0x1:	p = put_hex(put_str(p, "\t[PC:"), op & 0xFFF, 4);	*p++ = ']';	break;
+		case 0x2:	p = put_stack(p, op & 0xFFF, chip);	break;
+		case 0x3:	p = put_skip(p, rec, chip, chip.V[x], nn, true);	break;
+		case 0x4:	p = put_skip(p, rec, chip, chip.V[x], nn, false);	break;
+		case 0x5:
+			if((op & 0xF)!=0x2 && (op & 0xF)!=0x3)
+				p = put_skip(p, rec, chip, chip.V[x], chip.V[y], true);
+			break;
+		case 0x6:
+		case 0xC:	p = put_reg(p, x, chip.V[x]);	*p++ = ']';	break;
+		case 0x7:
+			p = put_reg(p, x, chip.V[x]);
+			p = put_hex(put_str(p, ",rF:"), chip.V[15], 2);
+			*p++ = ']';
+			break;
+		case 0x8:
+			p = put_reg(p, x, chip.V[x]);
+			if((op & 0xF)==0x4)
+				p = put_hex(put_str(p, ",rF:"), chip.V[15], 2);
+			else if((op & 0xF)==0x5 || (op & 0xF)==0x7)
+				p = put_hex(put_str(p, ", rF:"), chip.V[15], 2);
+			*p++ = ']';
+			break;
+		case 0x9:	p = put_skip(p, rec, chip, chip.V[x], chip.V[y], false);	break;
+		case 0xA:	p = put_hex(put_str(p, "\t[IX:"), chip.IX, 4);	*p++ = ']';	break;
+		case 0xB: {
+			word pc = (op & 0xFFF) + chip.V[(chip.quirks & QUIRK_JMPVX) ? x : 0];
+			p = put_hex(put_str(p, "\t[PC:"), pc, 4);
+			*p++ = ']';
+			break;
+		}
+		case 0xE:
+			if(nn==0x9E || nn==0xA1)
+				p = put_skip(p, rec, chip, Chip8::key_code(chip.KEY), chip.V[x], nn==0x9E);
+			break;
+		case 0xF:
+			// the timers tick between records, the value set is Vx
+			if(nn==0x07) {
+				p = put_reg(p, x, chip.V[x]);
+				*p++ = ']';
+			} else if(nn==0x15) {
+				p = put_hex(put_str(p, "\t[DT:"), chip.V[x], 2);
+				*p++ = ']';
+			} else if(nn==0x18) {
+				p = put_hex(put_str(p, "\t[ST:"), chip.V[x], 2);
+				*p++ = ']';
+			}
+			break;
+	}
+	return p;
+}
+
+// ADDR:@ OPCODE MNEMONIC then the registers, what a TRACE=2 build prints
+int trace_text(const TraceRec& rec, const Chip8& chip, const Cfg& cfg, char* buf)
+{
+	char* p = buf;
+	if(rec.pc>=PROG_START+chip.prog_size) {
+		// exec1() stops before the address
+		p = put_str(p, "End of program\n");
+		*p = 0;
+		return p-buf;
+	}
+
+	p = put_hex(p, rec.pc, 4);
+	*p++ = ':';
+	if(cfg.is_label(rec.pc))
+		*p++ = '@';
+	*p++ = '\t';
+	p = put_hex(p, rec.op, 4);
+	*p++ = '\t';
+	p += dis_1(rec.op, p, NULL, rec.op==0xF000 && (rec.flags & TR_IX) ? rec.IX : -1);
+	p = put_regs(p, rec, chip);
+	*p++ = '\n';
+	if(rec.flags & TR_END) {
+		p = put_str(p, "End of memory PC:");
+		p = put_hex(p, rec.pc, 4);
+		*p++ = '\n';
+	}
+	*p = 0;
+	return p-buf;
+}
@@ -0,0 +1,197 @@
+// Tracer.h
+
+#ifndef TRACER_H
+#define TRACER_H
+
+#include <stdio.h>
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Cfg.h"
+#include "Chip8.h"
+#include "Ring.h"
+
+// Binary instruction trace of one Chip8, for runs too long for TRACE builds
+//
+// The emulation thread appends a small record per instruction to a chunk of
+// memory, a full chunk goes through a lock-free ring to a writer thread that
+// writes it out in one fwrite and hands the chunk back. No stdio and no
+// locks on the emulation side.
+//
+// file, little endian, version 2:
+//	"C8TR" version:16 block:16 checkpoint:16 prog_size:16 program[prog_size]
+//	blocks of `block` records (the last one can be short):
+//		first:64 (instruction number) count:32 bytes:32 state:32
+//		state bytes, a save state from before the first record (every
+//		`checkpoint` blocks, 0 bytes in the others), then the records
+//	index, written at the end:
+//		offset:64 per block, then blocks:32 count:64 "C8IX"
+//	record:
+//		pc:16 op:16 flags:8, then per flag, in this order
+//		TR_V		mask:16, V[i] for every bit i
+//		TR_IX		IX:16						(also after F000 nnnn, changed or not)
+//		TR_SP		SP:8 stack[SP-1]:16
+//		TR_TIMER	DT:8 ST:8
+//		TR_MEM		addr:16 n:8 bytes[n]		(STO, BCD, 5xy2)
+//		TR_KEY		KEY:8						(changed since the last record)
+//		TR_HALT		-							(the instruction stopped the machine)
+//		TR_END		-							(with TR_HALT, it ran PC past FFFF)
+// the changes are what the instruction did, the timer ticks between
+// instructions are not in it
+//
+// Instruction n is in block n/block, so with the index a seek is one fseek
+// and at most `block` records decoded. A trace cut short (crash) has no
+// index, the reader then finds the blocks by reading their headers.
+//
+// usage:
+//	Tracer tr(&chip, "run.c8tr");	// attach, chip.run() now goes through here
+//	chip.run(n);					// or tr.step() instead of chip.exec1()
+//	TraceDump run.c8tr				// text, like a TRACE=2 build
+//	TraceDiff a.c8tr b.c8tr			// first instruction where two runs differ
+
+enum TRACE_FLAG {
+	TR_V		= 0x01,
+	TR_IX		= 0x02,
+	TR_SP		= 0x04,
+	TR_TIMER	= 0x08,
+	TR_MEM		= 0x10,
+	TR_KEY		= 0x20,
+	TR_HALT		= 0x40,
+	TR_END		= 0x80,
+};
+
+const int TRACE_BLOCK		= 4096;		// records per block
+const int TRACE_CHECKPOINT	= 64;		// blocks per save state, 256K instructions
+const int TRACE_REC_MAX		= 5 + 2+16 + 2 + 3 + 2 + 3+16 + 1;
+const int TRACE_BLOCK_HEAD	= 20;
+
+// one decoded record
+struct TraceRec {
+	long long n;			// instruction number, from 0
+	word pc;
+	word op;
+	byte flags;
+	word vmask;
+	byte V[16];				// only the ones in vmask
+	word IX;
+	byte SP;
+	word top;				// stack[SP-1]
+	byte DT;
+	byte ST;
+	word mem_addr;
+	byte mem_n;
+	byte mem[16];
+	byte KEY;
+};
+
+class Tracer {
+public:
+	Tracer(Chip8* chip, const char* filename);
+	~Tracer();						// writes out the rest, stops the thread
+	Tracer(const Tracer&) = delete;
+	Tracer& operator=(const Tracer&) = delete;
+
+	bool ok() const { return file!=NULL && !failed; }
+
+	bool step();					// Chip8::exec1(), recorded
+	long long run(long long max_instr);
+
+	long long records() const { return count; }
+
+private:
+	static const int CHUNK_SIZE	= 1<<20;
+	static const int CHUNKS		= 16;		// at most, 16MB in flight
+
+	struct Chunk {
+		byte* data;
+		int used;
+	};
+
+	Chip8* chip;
+	FILE* file;
+	std::atomic<bool> failed;
+
+	// emulation thread
+	Chunk* cur;
+	byte* block;				// header of the open block in cur, NULL: none
+	int block_cnt;
+	long long count;
+	byte last_key;
+	int allocated;
+	long long file_pos;			// where the next block goes in the file
+	std::vector<long long> index;	// file offset per block
+	std::vector<byte> state;
+
+	// writer thread
+	Ring<Chunk*, 32> full;
+	Ring<Chunk*, 32> empty;
+	std::atomic<bool> running;
+	std::thread thread;
+
+	void open_block();
+	void close_block();
+	void hand_off();
+	void write_loop();
+	void write_index();
+};
+
+// reads a trace file, front to back in big reads, or from any instruction
+class TraceReader {
+public:
+	int prog_size;
+	byte prog[PROG_MAX_SIZE];
+	long long count;				// instructions in the trace, -1: not known (no index)
+	bool bad;
+
+	TraceReader();
+	~TraceReader();
+	TraceReader(const TraceReader&) = delete;
+	TraceReader& operator=(const TraceReader&) = delete;
+
+	bool open(const char* filename);
+	bool next(TraceRec& rec);		// false: end of trace (or damaged, see bad)
+	bool seek(long long n);			// next() gives instruction n, false: not in the trace
+
+	// whole blocks, for comparing two traces without decoding them
+	// next_block() drops the rest of the current block
+	bool next_block();
+	bool same_block(const TraceReader& other) const;
+	long long block_first() const { return first; }
+
+	// the machine before instruction n: the checkpoint before it, with the
+	// records up to n applied (registers, stack, memory, not the timer ticks)
+	bool state_at(long long n, Chip8& chip);
+
+private:
+	FILE* file;
+	long long data_start;			// first block
+	long long data_end;				// the index, -1: no index, blocks go to the end
+	int block;						// records per block
+	int checkpoint;					// blocks per save state
+	std::vector<long long> index;	// offset per block
+
+	std::vector<byte> buf;			// the current block
+	std::vector<byte> state_buf;	// its save state, if it has one
+	int pos;
+	int left;						// records left in it
+	long long first;				// instruction number of its first record
+	long long n;
+
+	bool read_block();
+	void scan_index();
+};
+
+// what a record did, done to chip
+void trace_apply(const TraceRec& rec, Chip8& chip);
+
+// text of one record, the line a TRACE=2 build prints for it (labels from cfg)
+// chip is the machine with the record applied (state_at(), then trace_apply()
+// for every record), the skips, stack and flags in the text come from it
+// buf needs TRACE_TEXT_MAX bytes, returns the length
+const int TRACE_TEXT_MAX = 256;
+int trace_text(const TraceRec& rec, const Chip8& chip, const Cfg& cfg, char* buf);
+
+#endif